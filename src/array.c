@@ -1,38 +1,192 @@
 #include "array.h"
 #include "util.h"
 #include "string.h"
+#include "number.h"
+#include "sink.h"
 
-static void json_array_free(JSON_Value *arr)
+#ifdef JSON_HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
+#define JSON_ARRAY_INITIAL_RESERVED 4
+#define JSON_ARRAY_GROW_FACTOR 2
+// Only give memory back once the array is this many times smaller than
+// its storage, so alternating insert/remove doesn't realloc every time.
+#define JSON_ARRAY_SHRINK_THRESHOLD 4
+
+#define JSON_ARRAY_IS_PACKED(arr) JSON_UNLIKELY((arr)->kind != JSON_ARRAY_KIND_VALUES)
+
+static inline size_t json_array_elem_size(const JSON_Array *arr)
+{
+	switch (arr->kind)
+	{
+		case JSON_ARRAY_KIND_DOUBLE:
+			return sizeof(double);
+		case JSON_ARRAY_KIND_INT64:
+			return sizeof(int64_t);
+		default:
+			return sizeof(JSON_Value*);
+	}
+}
+
+static inline char *json_array_data(const JSON_Array *arr)
+{
+	switch (arr->kind)
+	{
+		case JSON_ARRAY_KIND_DOUBLE:
+			return (char*) arr->packed.doubles;
+		case JSON_ARRAY_KIND_INT64:
+			return (char*) arr->packed.ints;
+		default:
+			return (char*) arr->array;
+	}
+}
+
+static inline void json_array_set_data(JSON_Array *arr, char *data)
+{
+	switch (arr->kind)
+	{
+		case JSON_ARRAY_KIND_DOUBLE:
+			arr->packed.doubles = (double*)(void*) data;
+			break;
+		case JSON_ARRAY_KIND_INT64:
+			arr->packed.ints = (int64_t*)(void*) data;
+			break;
+		default:
+			arr->array = (JSON_Value**)(void*) data;
+			break;
+	}
+}
+
+// Number views handed out by json_array_nth() for packed arrays. They
+// are owned by the array and dropped whenever it's modified.
+static void json_array_drop_views(JSON_Array *arr)
 {
 	size_t i;
+	if (JSON_LIKELY(arr->views__ == NULL))
+		return;
+	for (i = 0; i < arr->size; i++)
+	{
+		if (arr->views__[i] != NULL)
+			json_value_unref(arr->views__[i]);
+	}
+	json_free(arr->views__);
+	arr->views__ = NULL;
+}
+
+// Load the nth element of a packed array into `num`
+static void json_array_packed_load(JSON_Array *arr, size_t n, JSON_Number *num)
+{
+	if (arr->kind == JSON_ARRAY_KIND_INT64)
+		json_number_set_int64(num, arr->packed.ints[n]);
+	else
+		json_number_set(num, arr->packed.doubles[n]);
+}
+
+void json_array_iter_init(JSON_ArrayIter *iter, JSON_Array *arr)
+{
+	assert(iter != NULL);
+	assert(JSON_IS_ARRAY(arr));
+	iter->value = NULL;
+	iter->index = 0;
+	iter->arr__ = arr;
+	iter->pos__ = 0;
+	if (JSON_ARRAY_IS_PACKED(arr))
+		json_number_init(&iter->number__);
+}
+
+bool json_array_iter_next(JSON_ArrayIter *iter)
+{
+	JSON_Array *arr = iter->arr__;
+	size_t n = iter->pos__;
+
+	if (n >= arr->size)
+		return false;
+
+	iter->index = n;
+	iter->pos__ = n + 1;
+
+	if (JSON_ARRAY_IS_PACKED(arr))
+	{
+		JSON_VALUE(&iter->number__)->flags &= ~JSON_VALUE_FLAG_READONLY;
+		json_array_packed_load(arr, n, &iter->number__);
+		JSON_VALUE(&iter->number__)->flags |= JSON_VALUE_FLAG_READONLY;
+		iter->value = JSON_VALUE(&iter->number__);
+		return true;
+	}
+
+	if (n + 1 < arr->size)
+		JSON_PREFETCH(arr->array[n + 1]);
+	iter->value = arr->array[n];
+	return true;
+}
+
+static void json_array_free(JSON_Value *value)
+{
+	JSON_Array *arr = JSON_ARRAY(value);
+	JSON_ArrayIter iter;
+	char *data;
 	assert(arr);
+	json_array_drop_views(arr);
+	json_cache_free__(&arr->link__);
 	// Unref all of the elements, possibly destroying them
-	for (i = 0; i < JSON_ARRAY(arr)->size; i++)
-		json_value_unref(JSON_ARRAY(arr)->array[i]);
-	if (JSON_ARRAY(arr)->array)
-		json_free(JSON_ARRAY(arr)->array);
+	if (!JSON_ARRAY_IS_PACKED(arr))
+	{
+		json_array_iter_init(&iter, arr);
+		while (json_array_iter_next(&iter))
+		{
+			json_cache_release__(value, iter.value);
+			json_value_unref(iter.value);
+		}
+	}
+	data = json_array_data(arr);
+	if (data)
+		json_free(data - arr->head__ * json_array_elem_size(arr));
 }
 
-static JSON_Value *json_array_clone(JSON_Value *arr)
+static JSON_Value *json_array_clone(JSON_Value *value)
 {
-	JSON_Array *new_arr = json_array_new();
-	if (new_arr != NULL)
+	JSON_Array *arr = JSON_ARRAY(value);
+	JSON_Array *new_arr;
+
+	if (JSON_ARRAY_IS_PACKED(arr))
+		new_arr = json_array_new_packed(arr->kind);
+	else
+		new_arr = json_array_new();
+
+	if (new_arr != NULL && json_array_reserve(new_arr, arr->size))
 	{
-		new_arr->array = json_malloc(JSON_ARRAY(arr)->size * sizeof(JSON_Value*));
-		if (new_arr->array != NULL)
+		JSON_ArrayIter iter;
+		new_arr->size = arr->size;
+		if (JSON_ARRAY_IS_PACKED(arr))
 		{
-			size_t i;
-			new_arr->size = JSON_ARRAY(arr)->size;
-			for (i = 0; i < JSON_ARRAY(arr)->size; i++)
-				new_arr->array[i] = json_value_clone(JSON_ARRAY(arr)->array[i]);
+			memcpy(json_array_data(new_arr), json_array_data(arr),
+				arr->size * json_array_elem_size(arr));
+		}
+		else
+		{
+			json_array_iter_init(&iter, arr);
+			while (json_array_iter_next(&iter))
+			{
+				new_arr->array[iter.index] = json_value_clone(iter.value);
+				json_cache_adopt__(JSON_VALUE(new_arr), new_arr->array[iter.index]);
+			}
 		}
 	}
 	return JSON_VALUE(new_arr);
 }
 
+static JSON_Number *json_array_packed_number(JSON_Array *arr, size_t n)
+{
+	if (arr->kind == JSON_ARRAY_KIND_INT64)
+		return json_number_new_int64(arr->packed.ints[n]);
+	return json_number_new(arr->packed.doubles[n]);
+}
+
 static bool json_array_equal(const JSON_Value *val1, const JSON_Value *val2)
 {
 	JSON_Array *arr1, *arr2;
+	JSON_ArrayIter iter1, iter2;
 	size_t i;
 
 	assert(JSON_IS_ARRAY(val1));
@@ -44,49 +198,86 @@ static bool json_array_equal(const JSON_Value *val1, const JSON_Value *val2)
 	if (json_array_size(arr1) != json_array_size(arr2))
 		return false;
 
-	for (i = 0; i < json_array_size(arr1); i++)
+	// Packed the same way, compare the plain numbers
+	if (JSON_ARRAY_IS_PACKED(arr1) && arr1->kind == arr2->kind)
 	{
-		if (!json_value_equal(json_array_nth(arr1, i), json_array_nth(arr2, i)))
+		for (i = 0; i < arr1->size; i++)
+		{
+			if (arr1->kind == JSON_ARRAY_KIND_INT64 ?
+			    (arr1->packed.ints[i] != arr2->packed.ints[i]) :
+			    (arr1->packed.doubles[i] != arr2->packed.doubles[i]))
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+
+	// Otherwise packed elements are compared as numbers, without
+	// materializing views
+	json_array_iter_init(&iter1, arr1);
+	json_array_iter_init(&iter2, arr2);
+	while (json_array_iter_next(&iter1) && json_array_iter_next(&iter2))
+	{
+		if (!json_value_equal(iter1.value, iter2.value))
 			return false;
 	}
 
 	return true;
 }
 
-static JSON_String *json_array_to_string(JSON_Value *value, int indent)
+// Writes elements `begin` up to `end` as they appear inside the array's
+// brackets, each with the separator that goes before it
+void json_array_write_range__(JSON_Array *arr, JSON_Sink *sink, int indent,
+	size_t begin, size_t end)
+{
+	JSON_ArrayIter iter;
+
+	assert(begin <= end && end <= arr->size);
+
+	json_array_iter_init(&iter, arr);
+	iter.pos__ = begin;
+	while (iter.pos__ < end && json_array_iter_next(&iter))
+	{
+		if (iter.index > 0)
+			json_sink_putc(sink, ',');
+		json_sink_write_newline(sink, indent + 1);
+		// Packed elements are written straight from the packed data
+		if (arr->kind == JSON_ARRAY_KIND_INT64)
+			json_sink_write_int64(sink, arr->packed.ints[iter.index]);
+		else if (arr->kind == JSON_ARRAY_KIND_DOUBLE)
+			json_sink_write_double(sink, arr->packed.doubles[iter.index]);
+		else
+			json_value_write(iter.value, sink, indent + 1);
+	}
+}
+
+static void json_array_write_elements(JSON_Value *value, JSON_Sink *sink, int indent)
 {
-	size_t i;
-	JSON_String *str;
 	JSON_Array *arr;
-	char *indent_str;
 
 	assert(JSON_IS_ARRAY(value));
 	arr = JSON_ARRAY(value);
 
-	indent_str = json_make_indent_string(indent);
-	str = json_string_new_printf("%s[\n", indent_str);
-	json_free(indent_str);
-
-	indent++;
-
-	for (i = 0; i < arr->size; i++)
+	if (arr->size == 0)
 	{
-		JSON_String *tmp = json_value_to_string(arr->array[i], indent);
-		json_string_append(str, tmp);
-		json_value_unref(JSON_VALUE(tmp));
-		if (i != (arr->size - 1))
-			json_string_append_cstr(str, ",\n");
-		else
-			json_string_append_char(str, '\n');
+		json_sink_write(sink, "[]", 2);
+		return;
 	}
 
-	indent--;
-
-	indent_str = json_make_indent_string(indent);
-	json_string_append_printf(str, "%s]", indent_str);
-	json_free(indent_str);
+	json_sink_putc(sink, '[');
+	json_array_write_range__(arr, sink, indent, 0, arr->size);
+	json_sink_write_newline(sink, indent);
+	json_sink_putc(sink, ']');
+}
 
-	return str;
+static void json_array_write(JSON_Value *value, JSON_Sink *sink, int indent)
+{
+	JSON_CacheLink *link = &JSON_ARRAY(value)->link__;
+	if (json_cache_needed__(value, link))
+		json_cache_write__(value, link, sink, indent, json_array_write_elements);
+	else
+		json_array_write_elements(value, sink, indent);
 }
 
 JSON_Array *json_array_new(void)
@@ -107,23 +298,287 @@ size_t json_array_size(JSON_Array *arr)
 	return arr->size;
 }
 
+static JSON_Value *json_array_packed_nth(JSON_Array *arr, size_t n)
+{
+	JSON_Number *num;
+
+	if (arr->views__ == NULL)
+		arr->views__ = json_malloc(arr->size * sizeof(JSON_Value*));
+
+	if (arr->views__[n] == NULL)
+	{
+		num = json_array_packed_number(arr, n);
+		JSON_VALUE(num)->flags |= JSON_VALUE_FLAG_READONLY;
+		arr->views__[n] = json_value_ref_sink(num);
+	}
+
+	return arr->views__[n];
+}
+
+// For packed arrays the returned JSON_Number is a read-only view of the
+// element which is only valid until the array is next modified.
 JSON_Value *json_array_nth(JSON_Array *arr, size_t n)
 {
 	assert(arr);
 	assert(n < arr->size);
+	if (JSON_ARRAY_IS_PACKED(arr))
+		return json_array_packed_nth(arr, n);
 	return arr->array[n];
 }
 
-static bool json_array_resize(JSON_Array *arr, size_t new_size)
+// Storage is a single block of `reserved__` slots holding the elements
+// contiguously starting `head__` slots in. Keeping free slots at both
+// ends makes insertion and removal at either end amortized O(1), while
+// `array` still points straight at the first element so indexing is a
+// plain offset.
+
+static inline size_t json_array_tail_room(const JSON_Array *arr)
 {
-	JSON_Value **temp = json_realloc(arr->array, new_size * sizeof(JSON_Value*));
-	if (temp != NULL)
+	return arr->reserved__ - arr->head__ - arr->size;
+}
+
+// Move the elements into storage with `reserved` slots, `head` slots in.
+static bool json_array_relayout(JSON_Array *arr, size_t reserved, size_t head)
+{
+	size_t elem_size = json_array_elem_size(arr);
+	char *data, *base, *temp;
+
+	assert(head + arr->size <= reserved);
+
+	data = json_array_data(arr);
+	base = data ? (data - arr->head__ * elem_size) : NULL;
+
+	if (reserved == 0)
 	{
-		arr->array = temp;
-		arr->size = new_size;
+		if (base)
+			json_free(base);
+		json_array_set_data(arr, NULL);
+		arr->reserved__ = 0;
+		arr->head__ = 0;
 		return true;
 	}
-	return false;
+	else if (reserved == arr->reserved__)
+	{
+		memmove(base + head * elem_size, data, arr->size * elem_size);
+		temp = base;
+	}
+	else if (head == arr->head__)
+	{
+		temp = json_realloc(base, reserved * elem_size);
+		if (temp == NULL)
+			return false;
+	}
+	else
+	{
+		temp = json_malloc(reserved * elem_size);
+		if (temp == NULL)
+			return false;
+		if (base)
+		{
+			memcpy(temp + head * elem_size, data, arr->size * elem_size);
+			json_free(base);
+		}
+	}
+
+	json_array_set_data(arr, temp + head * elem_size);
+	arr->reserved__ = reserved;
+	arr->head__ = head;
+	return true;
+}
+
+static inline size_t json_array_grown_size(const JSON_Array *arr, size_t n)
+{
+	size_t reserved = arr->reserved__ * JSON_ARRAY_GROW_FACTOR;
+	if (reserved < JSON_ARRAY_INITIAL_RESERVED)
+		reserved = JSON_ARRAY_INITIAL_RESERVED;
+	if (reserved < n)
+		reserved = n;
+	return reserved;
+}
+
+bool json_array_reserve(JSON_Array *arr, size_t n)
+{
+	assert(JSON_IS_ARRAY(arr));
+	if (arr->head__ + n <= arr->reserved__)
+		return true;
+	else if (n <= arr->reserved__)
+		return json_array_relayout(arr, arr->reserved__, 0);
+	return json_array_relayout(arr, n, 0);
+}
+
+// Make room for `n` more elements after the last one. When the free
+// slots are mostly at the front (ie. the array is used as a queue) the
+// elements are slid down instead, which is paid for by the pops that
+// freed those slots.
+static bool json_array_grow_back(JSON_Array *arr, size_t n)
+{
+	size_t needed, head;
+
+	if (JSON_LIKELY(n <= json_array_tail_room(arr)))
+		return true;
+
+	needed = arr->size + n;
+	if (needed <= arr->reserved__ && arr->head__ >= arr->size)
+		return json_array_relayout(arr, arr->reserved__, 0);
+
+	head = (arr->head__ < arr->size) ? arr->head__ : 0;
+	return json_array_relayout(arr, json_array_grown_size(arr, head + needed),
+		head);
+}
+
+// Make room for `n` more elements before the first one, re-centering the
+// elements so that a run of prepends has room to continue.
+static bool json_array_grow_front(JSON_Array *arr, size_t n)
+{
+	size_t needed, reserved;
+
+	if (JSON_LIKELY(n <= arr->head__))
+		return true;
+
+	needed = arr->size + n;
+	reserved = arr->reserved__;
+	if (needed > reserved || json_array_tail_room(arr) < arr->size)
+		reserved = json_array_grown_size(arr, needed);
+
+	return json_array_relayout(arr, reserved,
+		n + (reserved - needed) / 2);
+}
+
+// Open up an uninitialized slot at `pos`, shifting whichever side of it
+// is shorter.
+static bool json_array_open_slot(JSON_Array *arr, size_t pos)
+{
+	size_t elem_size = json_array_elem_size(arr);
+	char *data;
+
+	if (pos < arr->size / 2)
+	{
+		if (!json_array_grow_front(arr, 1))
+			return false;
+		data = json_array_data(arr) - elem_size;
+		json_array_set_data(arr, data);
+		arr->head__--;
+		memmove(data, data + elem_size, pos * elem_size);
+	}
+	else
+	{
+		if (!json_array_grow_back(arr, 1))
+			return false;
+		data = json_array_data(arr);
+		memmove(data + (pos + 1) * elem_size, data + pos * elem_size,
+			(arr->size - pos) * elem_size);
+	}
+
+	arr->size++;
+	return true;
+}
+
+// Close up the slot at `pos`, shifting whichever side of it is shorter.
+static void json_array_close_slot(JSON_Array *arr, size_t pos)
+{
+	size_t elem_size = json_array_elem_size(arr);
+	char *data = json_array_data(arr);
+
+	if (pos < arr->size / 2)
+	{
+		memmove(data + elem_size, data, pos * elem_size);
+		json_array_set_data(arr, data + elem_size);
+		arr->head__++;
+	}
+	else
+	{
+		memmove(data + pos * elem_size, data + (pos + 1) * elem_size,
+			(arr->size - pos - 1) * elem_size);
+	}
+	arr->size--;
+
+	if (arr->size == 0)
+	{
+		json_array_set_data(arr, json_array_data(arr) - arr->head__ * elem_size);
+		arr->head__ = 0;
+	}
+
+	if (arr->reserved__ > JSON_ARRAY_INITIAL_RESERVED &&
+	    arr->size * JSON_ARRAY_SHRINK_THRESHOLD <= arr->reserved__)
+	{
+		json_array_relayout(arr, arr->reserved__ / JSON_ARRAY_GROW_FACTOR, 0);
+	}
+}
+
+// Whether `value` can be stored in the packed array without losing
+// anything.
+static bool json_array_can_pack(JSON_Array *arr, JSON_Value *value)
+{
+	JSON_Number *num;
+	int64_t temp;
+
+	if (!JSON_IS_NUMBER(value))
+		return false;
+
+	num = JSON_NUMBER(value);
+	if (arr->kind == JSON_ARRAY_KIND_INT64)
+	{
+		return (json_number_is_integer(num) ||
+			json_double_to_int64(json_number_get(num), NULL));
+	}
+	else if (json_number_is_integer(num))
+	{
+		return (json_double_to_int64(json_number_get(num), &temp) &&
+			temp == json_number_get_int64(num));
+	}
+	return true;
+}
+
+// Turn a packed array back into an array of JSON_Values, reusing any
+// views that were already handed out.
+static bool json_array_unpack(JSON_Array *arr)
+{
+	JSON_Value **array;
+	size_t i;
+	char *data;
+
+	if (arr->reserved__ > 0)
+	{
+		array = json_malloc(arr->reserved__ * sizeof(JSON_Value*));
+		if (array == NULL)
+			return false;
+	}
+	else
+		array = NULL;
+
+	for (i = 0; i < arr->size; i++)
+	{
+		JSON_Value *value = arr->views__ ? arr->views__[i] : NULL;
+		if (value != NULL)
+			value->flags &= ~JSON_VALUE_FLAG_READONLY;
+		else
+			value = json_value_ref_sink(json_array_packed_number(arr, i));
+		array[arr->head__ + i] = value;
+	}
+
+	if (arr->views__)
+	{
+		json_free(arr->views__);
+		arr->views__ = NULL;
+	}
+
+	data = json_array_data(arr);
+	if (data)
+		json_free(data - arr->head__ * json_array_elem_size(arr));
+	arr->packed.doubles = NULL;
+	arr->kind = JSON_ARRAY_KIND_VALUES;
+	arr->array = array ? (array + arr->head__) : NULL;
+
+	return true;
+}
+
+static inline void json_array_packed_store(JSON_Array *arr, size_t n,
+	JSON_Number *num)
+{
+	if (arr->kind == JSON_ARRAY_KIND_INT64)
+		arr->packed.ints[n] = json_number_get_int64(num);
+	else
+		arr->packed.doubles[n] = json_number_get(num);
 }
 
 bool json_array_insert(JSON_Array *arr, JSON_Value *value, size_t pos)
@@ -134,43 +589,523 @@ bool json_array_insert(JSON_Array *arr, JSON_Value *value, size_t pos)
 	if (pos > arr->size)
 		return false;
 
-	if (!json_array_resize(arr, arr->size + 1))
+	json_cache_touch__(JSON_VALUE(arr));
+
+	if (JSON_ARRAY_IS_PACKED(arr))
+	{
+		if (json_array_can_pack(arr, value))
+		{
+			// The value may itself be one of the views being dropped
+			json_value_ref(value);
+			json_array_drop_views(arr);
+			if (!json_array_open_slot(arr, pos))
+			{
+				json_value_unref(value);
+				return false;
+			}
+			json_array_packed_store(arr, pos, JSON_NUMBER(value));
+			json_value_unref(json_value_ref_sink(value));
+			json_value_unref(value);
+			return true;
+		}
+		else if (!json_array_unpack(arr))
+			return false;
+	}
+
+	if (!json_array_open_slot(arr, pos))
+		return false;
+
+	json_cache_adopt__(JSON_VALUE(arr), value);
+	arr->array[pos] = json_value_ref_sink(value);
+
+	return true;
+}
+
+bool json_array_append_many(JSON_Array *arr, JSON_Value **values, size_t n)
+{
+	size_t i;
+
+	assert(JSON_IS_ARRAY(arr));
+	assert(values != NULL || n == 0);
+
+	if (!json_array_grow_back(arr, n))
+		return false;
+
+	json_cache_touch__(JSON_VALUE(arr));
+
+	if (JSON_ARRAY_IS_PACKED(arr))
+	{
+		bool inserted = true;
+		// Any of the values may be views that the first insert drops
+		for (i = 0; i < n; i++)
+			json_value_ref(values[i]);
+		for (i = 0; i < n && inserted; i++)
+			inserted = json_array_insert(arr, values[i], arr->size);
+		for (i = 0; i < n; i++)
+			json_value_unref(values[i]);
+		return inserted;
+	}
+
+	for (i = 0; i < n; i++)
+	{
+		assert(values[i] != NULL);
+		json_cache_adopt__(JSON_VALUE(arr), values[i]);
+		arr->array[arr->size++] = json_value_ref_sink(values[i]);
+	}
+
+	return true;
+}
+
+// Append all of the elements of `other` (which may be `arr` itself),
+// sharing them rather than cloning.
+bool json_array_extend(JSON_Array *arr, JSON_Array *other)
+{
+	size_t i, n;
+
+	assert(JSON_IS_ARRAY(arr));
+	assert(JSON_IS_ARRAY(other));
+
+	n = other->size;
+
+	json_cache_touch__(JSON_VALUE(arr));
+
+	if (JSON_ARRAY_IS_PACKED(arr) && arr->kind == other->kind)
+	{
+		size_t elem_size = json_array_elem_size(arr);
+		json_array_drop_views(arr);
+		if (!json_array_grow_back(arr, n))
+			return false;
+		memmove(json_array_data(arr) + arr->size * elem_size,
+			json_array_data(other), n * elem_size);
+		arr->size += n;
+		return true;
+	}
+	else if (JSON_ARRAY_IS_PACKED(other))
+	{
+		for (i = 0; i < n; i++)
+		{
+			bool appended;
+			if (other->kind == JSON_ARRAY_KIND_INT64)
+				appended = json_array_append_int64(arr, other->packed.ints[i]);
+			else
+				appended = json_array_append_double(arr, other->packed.doubles[i]);
+			if (!appended)
+				return false;
+		}
+		return true;
+	}
+
+	if (!json_array_grow_back(arr, n))
 		return false;
 
-	if (pos == (arr->size - 1))
-		arr->array[pos] = json_value_ref_sink(value);
+	for (i = 0; i < n; i++)
+	{
+		if (JSON_ARRAY_IS_PACKED(arr))
+		{
+			if (!json_array_insert(arr, other->array[i], arr->size))
+				return false;
+		}
+		else
+		{
+			json_cache_adopt__(JSON_VALUE(arr), other->array[i]);
+			arr->array[arr->size++] = json_value_ref(other->array[i]);
+		}
+	}
+
+	return true;
+}
+
+// Remove the element at `pos` without unreffing it, passing the
+// reference held by the array to the caller.
+JSON_Value *json_array_pop_nth(JSON_Array *arr, size_t pos)
+{
+	JSON_Value *value;
+
+	assert(arr);
+	assert(pos < arr->size);
+
+	json_cache_touch__(JSON_VALUE(arr));
+
+	if (JSON_ARRAY_IS_PACKED(arr))
+	{
+		value = JSON_VALUE(json_array_packed_number(arr, pos));
+		json_array_drop_views(arr);
+	}
 	else
 	{
-		size_t i;
-		for (i = (arr->size - 1); i > pos; i--)
-			arr->array[i] = arr->array[i-1];
-		arr->array[pos] = json_value_ref_sink(value);
+		value = arr->array[pos];
+		json_cache_release__(JSON_VALUE(arr), value);
 	}
 
-	return false;
+	json_array_close_slot(arr, pos);
+
+	return value;
 }
 
 void json_array_remove_nth(JSON_Array *arr, size_t pos)
 {
-	size_t i;
+	json_value_unref(json_array_pop_nth(arr, pos));
+}
+
+JSON_Array *json_array_new_packed(JSON_ArrayKind kind)
+{
+	JSON_Array *arr = json_array_new();
+	if (arr != NULL)
+		arr->kind = kind;
+	return arr;
+}
+
+JSON_Array *json_array_new_doubles(const double *values, size_t n)
+{
+	JSON_Array *arr = json_array_new_packed(JSON_ARRAY_KIND_DOUBLE);
+	assert(values != NULL || n == 0);
+	if (arr != NULL && n > 0 && json_array_reserve(arr, n))
+	{
+		memcpy(arr->packed.doubles, values, n * sizeof(double));
+		arr->size = n;
+	}
+	return arr;
+}
+
+JSON_Array *json_array_new_int64s(const int64_t *values, size_t n)
+{
+	JSON_Array *arr = json_array_new_packed(JSON_ARRAY_KIND_INT64);
+	assert(values != NULL || n == 0);
+	if (arr != NULL && n > 0 && json_array_reserve(arr, n))
+	{
+		memcpy(arr->packed.ints, values, n * sizeof(int64_t));
+		arr->size = n;
+	}
+	return arr;
+}
+
+bool json_array_append_double(JSON_Array *arr, double value)
+{
+	assert(JSON_IS_ARRAY(arr));
+	if (arr->kind == JSON_ARRAY_KIND_DOUBLE)
+	{
+		json_cache_touch__(JSON_VALUE(arr));
+		json_array_drop_views(arr);
+		if (!json_array_grow_back(arr, 1))
+			return false;
+		arr->packed.doubles[arr->size++] = value;
+		return true;
+	}
+	return json_array_append(arr, json_number_new(value));
+}
 
+bool json_array_append_int64(JSON_Array *arr, int64_t value)
+{
+	assert(JSON_IS_ARRAY(arr));
+	if (arr->kind == JSON_ARRAY_KIND_INT64)
+	{
+		json_cache_touch__(JSON_VALUE(arr));
+		json_array_drop_views(arr);
+		if (!json_array_grow_back(arr, 1))
+			return false;
+		arr->packed.ints[arr->size++] = value;
+		return true;
+	}
+	return json_array_append(arr, json_number_new_int64(value));
+}
+
+// Non-numeric elements of regular arrays read as 0.
+double json_array_get_double(JSON_Array *arr, size_t n)
+{
 	assert(arr);
-	assert(pos < arr->size);
+	assert(n < arr->size);
+	switch (arr->kind)
+	{
+		case JSON_ARRAY_KIND_DOUBLE:
+			return arr->packed.doubles[n];
+		case JSON_ARRAY_KIND_INT64:
+			return (double) arr->packed.ints[n];
+		default:
+			if (JSON_IS_NUMBER(arr->array[n]))
+				return json_number_get(JSON_NUMBER(arr->array[n]));
+			return 0.0;
+	}
+}
 
-	json_value_unref(arr->array[pos]);
-	arr->array[pos] = NULL;
+// Non-numeric elements of regular arrays read as 0, doubles are
+// converted as by json_number_get_int64().
+int64_t json_array_get_int64(JSON_Array *arr, size_t n)
+{
+	JSON_Number num;
 
-	for (i = pos + 1; i < arr->size; i++)
-		arr->array[i - 1] = arr->array[i];
+	assert(arr);
+	assert(n < arr->size);
 
-	if ((arr->size - 1) == 0)
+	switch (arr->kind)
 	{
-		json_free(arr->array);
-		arr->array = NULL;
-		arr->size = 0;
+		case JSON_ARRAY_KIND_INT64:
+			return arr->packed.ints[n];
+		case JSON_ARRAY_KIND_DOUBLE:
+			json_number_init(&num);
+			json_number_set(&num, arr->packed.doubles[n]);
+			return json_number_get_int64(&num);
+		default:
+			if (JSON_IS_NUMBER(arr->array[n]))
+				return json_number_get_int64(JSON_NUMBER(arr->array[n]));
+			return 0;
 	}
-	else
-		json_array_resize(arr, arr->size - 1);
+}
+
+// The reductions below work on any array but are only fast on packed
+// ones. Regular arrays skip non-numeric elements. Partial sums are kept
+// in several lanes, so results may differ from a left-to-right sum in the
+// last bits.
+
+#ifdef JSON_HAVE_SSE2
+
+static double json_doubles_sum(const double *v, size_t n)
+{
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	double lanes[2], sum;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		acc0 = _mm_add_pd(acc0, _mm_loadu_pd(v + i));
+		acc1 = _mm_add_pd(acc1, _mm_loadu_pd(v + i + 2));
+	}
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+
+	sum = lanes[0] + lanes[1];
+	for (; i < n; i++)
+		sum += v[i];
+	return sum;
+}
+
+static double json_doubles_dot(const double *v1, const double *v2, size_t n)
+{
+	__m128d acc0 = _mm_setzero_pd(), acc1 = _mm_setzero_pd();
+	double lanes[2], sum;
+	size_t i;
+
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		acc0 = _mm_add_pd(acc0,
+			_mm_mul_pd(_mm_loadu_pd(v1 + i), _mm_loadu_pd(v2 + i)));
+		acc1 = _mm_add_pd(acc1,
+			_mm_mul_pd(_mm_loadu_pd(v1 + i + 2), _mm_loadu_pd(v2 + i + 2)));
+	}
+	_mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+
+	sum = lanes[0] + lanes[1];
+	for (; i < n; i++)
+		sum += v1[i] * v2[i];
+	return sum;
+}
+
+static void json_doubles_minmax(const double *v, size_t n, double *min, double *max)
+{
+	__m128d vmin, vmax;
+	double lanes[2];
+	size_t i;
+
+	assert(n > 0);
+
+	vmin = vmax = _mm_set1_pd(v[0]);
+	for (i = 0; i + 2 <= n; i += 2)
+	{
+		__m128d x = _mm_loadu_pd(v + i);
+		vmin = _mm_min_pd(vmin, x);
+		vmax = _mm_max_pd(vmax, x);
+	}
+
+	_mm_storeu_pd(lanes, vmin);
+	*min = (lanes[0] < lanes[1]) ? lanes[0] : lanes[1];
+	_mm_storeu_pd(lanes, vmax);
+	*max = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+
+	for (; i < n; i++)
+	{
+		if (v[i] < *min)
+			*min = v[i];
+		if (v[i] > *max)
+			*max = v[i];
+	}
+}
+
+#else // Plain C, written so compilers can vectorize it
+
+static double json_doubles_sum(const double *v, size_t n)
+{
+	double acc[4] = { 0.0, 0.0, 0.0, 0.0 };
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		acc[0] += v[i];
+		acc[1] += v[i + 1];
+		acc[2] += v[i + 2];
+		acc[3] += v[i + 3];
+	}
+	for (; i < n; i++)
+		acc[0] += v[i];
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+static double json_doubles_dot(const double *v1, const double *v2, size_t n)
+{
+	double acc[4] = { 0.0, 0.0, 0.0, 0.0 };
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		acc[0] += v1[i] * v2[i];
+		acc[1] += v1[i + 1] * v2[i + 1];
+		acc[2] += v1[i + 2] * v2[i + 2];
+		acc[3] += v1[i + 3] * v2[i + 3];
+	}
+	for (; i < n; i++)
+		acc[0] += v1[i] * v2[i];
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+static void json_doubles_minmax(const double *v, size_t n, double *min, double *max)
+{
+	size_t i;
+	assert(n > 0);
+	*min = *max = v[0];
+	for (i = 1; i < n; i++)
+	{
+		*min = (v[i] < *min) ? v[i] : *min;
+		*max = (v[i] > *max) ? v[i] : *max;
+	}
+}
+
+#endif // JSON_HAVE_SSE2
+
+static double json_int64s_sum(const int64_t *v, size_t n)
+{
+	double acc[4] = { 0.0, 0.0, 0.0, 0.0 };
+	size_t i;
+	for (i = 0; i + 4 <= n; i += 4)
+	{
+		acc[0] += (double) v[i];
+		acc[1] += (double) v[i + 1];
+		acc[2] += (double) v[i + 2];
+		acc[3] += (double) v[i + 3];
+	}
+	for (; i < n; i++)
+		acc[0] += (double) v[i];
+	return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+}
+
+static void json_int64s_minmax(const int64_t *v, size_t n, double *min, double *max)
+{
+	int64_t imin, imax;
+	size_t i;
+	assert(n > 0);
+	imin = imax = v[0];
+	for (i = 1; i < n; i++)
+	{
+		imin = (v[i] < imin) ? v[i] : imin;
+		imax = (v[i] > imax) ? v[i] : imax;
+	}
+	*min = (double) imin;
+	*max = (double) imax;
+}
+
+// Min/max over whatever elements are numbers, false if there are none
+static bool json_array_minmax(JSON_Array *arr, double *min, double *max)
+{
+	bool found = false;
+	size_t i;
+
+	if (arr->size == 0)
+		return false;
+
+	switch (arr->kind)
+	{
+		case JSON_ARRAY_KIND_DOUBLE:
+			json_doubles_minmax(arr->packed.doubles, arr->size, min, max);
+			return true;
+		case JSON_ARRAY_KIND_INT64:
+			json_int64s_minmax(arr->packed.ints, arr->size, min, max);
+			return true;
+		default:
+			break;
+	}
+
+	for (i = 0; i < arr->size; i++)
+	{
+		double value;
+		if (!JSON_IS_NUMBER(arr->array[i]))
+			continue;
+		value = json_number_get(JSON_NUMBER(arr->array[i]));
+		if (!found || value < *min)
+			*min = value;
+		if (!found || value > *max)
+			*max = value;
+		found = true;
+	}
+
+	return found;
+}
+
+double json_array_sum(JSON_Array *arr)
+{
+	double sum = 0.0;
+	size_t i;
+
+	assert(JSON_IS_ARRAY(arr));
+
+	switch (arr->kind)
+	{
+		case JSON_ARRAY_KIND_DOUBLE:
+			return json_doubles_sum(arr->packed.doubles, arr->size);
+		case JSON_ARRAY_KIND_INT64:
+			return json_int64s_sum(arr->packed.ints, arr->size);
+		default:
+			break;
+	}
+
+	for (i = 0; i < arr->size; i++)
+	{
+		if (JSON_IS_NUMBER(arr->array[i]))
+			sum += json_number_get(JSON_NUMBER(arr->array[i]));
+	}
+
+	return sum;
+}
+
+bool json_array_min(JSON_Array *arr, double *min)
+{
+	double max;
+	assert(JSON_IS_ARRAY(arr));
+	assert(min != NULL);
+	return json_array_minmax(arr, min, &max);
+}
+
+bool json_array_max(JSON_Array *arr, double *max)
+{
+	double min;
+	assert(JSON_IS_ARRAY(arr));
+	assert(max != NULL);
+	return json_array_minmax(arr, &min, max);
+}
+
+double json_array_dot(JSON_Array *arr1, JSON_Array *arr2)
+{
+	double sum = 0.0;
+	size_t i;
+
+	assert(JSON_IS_ARRAY(arr1));
+	assert(JSON_IS_ARRAY(arr2));
+	assert(arr1->size == arr2->size);
+
+	if (arr1->kind == JSON_ARRAY_KIND_DOUBLE &&
+	    arr2->kind == JSON_ARRAY_KIND_DOUBLE)
+	{
+		return json_doubles_dot(arr1->packed.doubles, arr2->packed.doubles,
+			arr1->size);
+	}
+
+	for (i = 0; i < arr1->size; i++)
+		sum += json_array_get_double(arr1, i) * json_array_get_double(arr2, i);
+
+	return sum;
 }
 
 struct JSON_ArrayClass
@@ -185,7 +1120,7 @@ void *json_array_get_class(void)
 		json_array_free,
 		json_array_clone,
 		json_array_equal,
-		json_array_to_string,
+		json_array_write,
 	} };
 	return &json_array_class;
 }
@@ -2,20 +2,59 @@
 #define JSON_ARRAY_H_
 
 #include "value.h"
+#include "number.h"
+#include "cache.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+// How the elements are stored. Packed arrays keep plain numbers in a
+// contiguous C array instead of one JSON_Number per element, and turn
+// back into a regular array if something other than a fitting number is
+// inserted.
+typedef enum
+{
+	JSON_ARRAY_KIND_VALUES = 0,
+	JSON_ARRAY_KIND_DOUBLE,
+	JSON_ARRAY_KIND_INT64,
+}
+JSON_ArrayKind;
+
 typedef struct
 {
 	JSON_Value base__;
-	JSON_Value **array;
+	JSON_Value **array;  // first element, `head__` slots into the storage
 	size_t size;
 	size_t reserved__;
+	size_t head__;
+	JSON_ArrayKind kind;
+	union
+	{
+		double *doubles;
+		int64_t *ints;
+	}
+	packed;              // first element when `kind` isn't VALUES
+	JSON_Value **views__;
+	JSON_CacheLink link__;
 }
 JSON_Array;
 
+// Walks an array's elements without allocating or touching reference
+// counts, `value` is borrowed. Elements of packed arrays are loaded into
+// a read-only number inside the iterator in turn, so there `value` is
+// only valid until the next step. The array mustn't be modified while
+// iterating.
+typedef struct
+{
+	JSON_Value *value;
+	size_t index;
+	JSON_Array *arr__;
+	size_t pos__;
+	JSON_Number number__;
+}
+JSON_ArrayIter;
+
 #define JSON_ARRAY(v)    ((JSON_Array*)(v))
 #define JSON_TYPE_ARRAY  json_array_get_class()
 #define JSON_IS_ARRAY(v) JSON_LIKELY(((v) != NULL) && (JSON_VALUE_CLASS(v) == JSON_TYPE_ARRAY))
@@ -25,8 +64,32 @@ JSON_Array *json_array_new(void);
 JSON_Array *json_array_init(JSON_Array *arr);
 size_t json_array_size(JSON_Array *arr);
 JSON_Value *json_array_nth(JSON_Array *arr, size_t n);
+bool json_array_reserve(JSON_Array *arr, size_t n);
 bool json_array_insert(JSON_Array *arr, JSON_Value *value, size_t pos);
+bool json_array_append_many(JSON_Array *arr, JSON_Value **values, size_t n);
+bool json_array_extend(JSON_Array *arr, JSON_Array *other);
 void json_array_remove_nth(JSON_Array *arr, size_t pos);
+JSON_Value *json_array_pop_nth(JSON_Array *arr, size_t pos);
+
+void json_array_iter_init(JSON_ArrayIter *iter, JSON_Array *arr);
+bool json_array_iter_next(JSON_ArrayIter *iter);
+
+// For parallel.c
+void json_array_write_range__(JSON_Array *arr, JSON_Sink *sink, int indent,
+	size_t begin, size_t end);
+
+JSON_Array *json_array_new_packed(JSON_ArrayKind kind);
+JSON_Array *json_array_new_doubles(const double *values, size_t n);
+JSON_Array *json_array_new_int64s(const int64_t *values, size_t n);
+bool json_array_append_double(JSON_Array *arr, double value);
+bool json_array_append_int64(JSON_Array *arr, int64_t value);
+double json_array_get_double(JSON_Array *arr, size_t n);
+int64_t json_array_get_int64(JSON_Array *arr, size_t n);
+
+double json_array_sum(JSON_Array *arr);
+bool json_array_min(JSON_Array *arr, double *min);
+bool json_array_max(JSON_Array *arr, double *max);
+double json_array_dot(JSON_Array *arr1, JSON_Array *arr2);
 
 #define json_array_prepend(arr, value) \
 	json_array_insert(JSON_ARRAY(arr), JSON_VALUE(value), 0)
@@ -35,6 +98,12 @@ void json_array_remove_nth(JSON_Array *arr, size_t pos);
 	json_array_insert(JSON_ARRAY(arr), JSON_VALUE(value), \
 		json_array_size(JSON_ARRAY(arr)))
 
+#define json_array_pop_front(arr) \
+	json_array_pop_nth(JSON_ARRAY(arr), 0)
+
+#define json_array_pop_back(arr) \
+	json_array_pop_nth(JSON_ARRAY(arr), json_array_size(JSON_ARRAY(arr)) - 1)
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -1,6 +1,6 @@
 #include "boolean.h"
 #include "util.h"
-#include "string.h"
+#include "sink.h"
 
 static JSON_Boolean json_true_;
 static JSON_Boolean json_false_;
@@ -45,19 +45,14 @@ static bool json_boolean_equal(const JSON_Value *val1, const JSON_Value *val2)
 	return (b1->value == b2->value);
 }
 
-static JSON_String *json_boolean_to_string(JSON_Value *value, int indent)
+static void json_boolean_write(JSON_Value *value, JSON_Sink *sink, int indent)
 {
-	JSON_String *str;
-	char *indent_str;
-
 	assert(JSON_IS_BOOLEAN(value));
-
-	indent_str = json_make_indent_string(indent);
-	str = json_string_new_printf("%s%s", indent_str,
-		json_boolean_get(JSON_BOOLEAN(value)) ? "true" : "false");
-	json_free(indent_str);
-
-	return str;
+	(void)indent;
+	if (json_boolean_get(JSON_BOOLEAN(value)))
+		json_sink_write(sink, "true", 4);
+	else
+		json_sink_write(sink, "false", 5);
 }
 
 JSON_Boolean *json_boolean_true(void)
@@ -90,7 +85,7 @@ void *json_boolean_get_class(void)
 		NULL,
 		json_boolean_clone,
 		json_boolean_equal,
-		json_boolean_to_string,
+		json_boolean_write,
 	} };
 	return &json_boolean_class;
 }
@@ -0,0 +1,181 @@
+#include "cache.h"
+#include "array.h"
+#include "object.h"
+#include "util.h"
+
+struct JSON_WriteCache
+{
+	JSON_String text;
+	bool valid;
+	bool uses_epoch;          // built from shared containers
+	int flags;
+	int indent;
+	uint64_t epoch;
+};
+
+// Bumped whenever something inside a shared container changes
+static uint64_t json_cache_epoch = 0;
+
+// Nothing needs invalidating while no container has a cache
+static size_t json_cache_count = 0;
+
+static JSON_CacheLink *json_cache_link(JSON_Value *v)
+{
+	if (JSON_IS_ARRAY(v))
+		return &JSON_ARRAY(v)->link__;
+	else if (JSON_IS_OBJECT(v))
+		return &JSON_OBJECT(v)->link__;
+	return NULL;
+}
+
+// Turns caching of `v`'s text on or off, returns false if `v` isn't an
+// array or object
+bool json_value_set_cached(void *v, bool cached)
+{
+	JSON_CacheLink *link;
+
+	assert(v != NULL);
+
+	link = json_cache_link(JSON_VALUE(v));
+	if (link == NULL)
+		return false;
+
+	if (cached && link->cache == NULL)
+	{
+		link->cache = json_new(struct JSON_WriteCache);
+		json_string_init(&link->cache->text);
+		json_cache_count++;
+	}
+	else if (!cached && link->cache != NULL)
+		json_cache_free__(link);
+
+	return true;
+}
+
+void json_cache_free__(JSON_CacheLink *link)
+{
+	if (link->cache != NULL)
+	{
+		json_value_unref(&link->cache->text);
+		json_free(link->cache);
+		link->cache = NULL;
+		json_cache_count--;
+	}
+}
+
+// `child` was put in `parent`. A container that already has a parent, or
+// that is put in the same parent twice, becomes shared for good. Text
+// built above it by then didn't depend on the epoch and is thrown away.
+void json_cache_adopt__(JSON_Value *parent, JSON_Value *child)
+{
+	JSON_CacheLink *link = json_cache_link(child);
+
+	if (link == NULL || (child->flags & JSON_VALUE_FLAG_SHARED))
+		return;
+
+	if (link->parent == NULL)
+		link->parent = parent;
+	else
+	{
+		json_cache_touch__(link->parent);
+		link->parent = NULL;
+		child->flags |= JSON_VALUE_FLAG_SHARED;
+	}
+}
+
+// `child` was taken out of `parent`, or `parent` is going away
+void json_cache_release__(JSON_Value *parent, JSON_Value *child)
+{
+	JSON_CacheLink *link = json_cache_link(child);
+	if (link != NULL && link->parent == parent)
+		link->parent = NULL;
+}
+
+// `v` changed, so neither its text nor that of anything above it is
+// right anymore
+void json_cache_touch__(JSON_Value *v)
+{
+	JSON_CacheLink *link;
+
+	if (JSON_LIKELY(json_cache_count == 0))
+		return;
+
+	while (v != NULL)
+	{
+		link = json_cache_link(v);
+		if (link->cache != NULL)
+			link->cache->valid = false;
+		if (v->flags & JSON_VALUE_FLAG_SHARED)
+		{
+			json_cache_epoch++;
+			break;
+		}
+		v = link->parent;
+	}
+}
+
+static bool json_cache_is_valid(struct JSON_WriteCache *cache, JSON_Sink *sink,
+	int indent)
+{
+	if (!cache->valid || cache->flags != sink->flags)
+		return false;
+	else if (!(sink->flags & JSON_WRITE_FLAGS_COMPACT) && cache->indent != indent)
+		return false;
+	return (!cache->uses_epoch || cache->epoch == json_cache_epoch);
+}
+
+// Writes `v` from its cached text if that's still good, otherwise with
+// `write` through the cache. Containers use this when they have a cache
+// or are shared, anything built from them has to know about the latter.
+void json_cache_write__(JSON_Value *v, JSON_CacheLink *link, JSON_Sink *sink,
+	int indent, JSON_WriteFunc write)
+{
+	struct JSON_WriteCache *cache = link->cache;
+	JSON_Sink tmp;
+
+	if (v->flags & JSON_VALUE_FLAG_SHARED)
+		sink->shared__ = true;
+
+	// Another thread could be writing a shared container too, so nothing
+	// at or below one is cached then
+	if (sink->parallel__ && (sink->uncached__ > 0 || (v->flags & JSON_VALUE_FLAG_SHARED)))
+	{
+		sink->uncached__++;
+		write(v, sink, indent);
+		sink->uncached__--;
+		return;
+	}
+
+	if (cache == NULL)
+	{
+		write(v, sink, indent);
+		return;
+	}
+
+	if (!json_cache_is_valid(cache, sink, indent))
+	{
+		cache->text.len = 0;
+		json_sink_init_string(&tmp, &cache->text);
+		tmp.flags = sink->flags;
+		tmp.parallel__ = sink->parallel__;
+		write(v, &tmp, indent);
+		json_sink_flush(&tmp);
+
+		if (tmp.failed)
+		{
+			cache->valid = false;
+			json_sink_fail(sink);
+			return;
+		}
+
+		cache->valid = true;
+		cache->uses_epoch = tmp.shared__;
+		cache->flags = sink->flags;
+		cache->indent = indent;
+		cache->epoch = json_cache_epoch;
+	}
+
+	if (cache->uses_epoch)
+		sink->shared__ = true;
+	json_sink_write(sink, cache->text.str, cache->text.len);
+}
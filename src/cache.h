@@ -0,0 +1,47 @@
+#ifndef JSON_CACHE_H_
+#define JSON_CACHE_H_
+
+#include "value.h"
+#include "sink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Arrays and objects can keep the text they were last serialized to, so
+// that writing a mostly unchanged document again is mostly copying. Each
+// container knows its parent and changing it through the array and
+// object functions throws away its own text and that of every container
+// above it. Scalars changed in place (json_string_assign() on a member,
+// say) aren't noticed, replace them instead.
+//
+// A container put in more than one place is marked shared and has no
+// single parent to notify, so changing anything inside it invalidates all
+// text that was built from shared containers, wherever it is.
+
+typedef struct
+{
+	JSON_Value *parent;
+	struct JSON_WriteCache *cache;
+}
+JSON_CacheLink;
+
+bool json_value_set_cached(void *v, bool cached);
+
+// For the container implementations
+void json_cache_adopt__(JSON_Value *parent, JSON_Value *child);
+void json_cache_release__(JSON_Value *parent, JSON_Value *child);
+void json_cache_touch__(JSON_Value *v);
+void json_cache_free__(JSON_CacheLink *link);
+void json_cache_write__(JSON_Value *v, JSON_CacheLink *link, JSON_Sink *sink,
+	int indent, JSON_WriteFunc write);
+
+// Whether a container's write has to go through json_cache_write__()
+#define json_cache_needed__(v, link) \
+	JSON_UNLIKELY((link)->cache != NULL || (JSON_VALUE(v)->flags & JSON_VALUE_FLAG_SHARED))
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // JSON_CACHE_H_
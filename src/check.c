@@ -0,0 +1,326 @@
+#include "json.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+// Regression checks and a few timings, built and run by `make check`
+
+// Two blocks with the same hash under the sdbm loop json_strhash() used to
+// have, so that any string of them collides with every other of the same
+// number of blocks
+#define CHECK_BLOCK_A "nnnnnnnn"
+#define CHECK_BLOCK_B "mkmssmkm"
+#define CHECK_BLOCK_LEN 8
+#define CHECK_BLOCKS 13
+#define CHECK_KEY_LEN (CHECK_BLOCKS * CHECK_BLOCK_LEN)
+#define CHECK_NUM_KEYS (1 << CHECK_BLOCKS)
+
+static int check_failures = 0;
+
+static void check(bool ok, const char *what)
+{
+	printf("%s - %s\n", ok ? "ok" : "FAIL", what);
+	if (!ok)
+		check_failures++;
+}
+
+static double check_seconds(clock_t start)
+{
+	return (double)(clock() - start) / CLOCKS_PER_SEC;
+}
+
+static uint32_t check_sdbm(const char *s, size_t n)
+{
+	uint32_t hash = 0;
+	size_t i;
+	for (i = 0; i < n; i++)
+		hash = (uint8_t) s[i] + (hash << 6) + (hash << 16) - hash;
+	return hash;
+}
+
+// Key `n` picks block A or B by each of its bits
+static void check_colliding_key(char *key, size_t n)
+{
+	size_t i;
+	for (i = 0; i < CHECK_BLOCKS; i++)
+	{
+		memcpy(key + i * CHECK_BLOCK_LEN,
+			((n >> i) & 1) ? CHECK_BLOCK_B : CHECK_BLOCK_A, CHECK_BLOCK_LEN);
+	}
+	key[CHECK_KEY_LEN] = '\0';
+}
+
+static void check_plain_key(char *key, size_t n)
+{
+	snprintf(key, CHECK_KEY_LEN + 1, "%0*lu", CHECK_KEY_LEN, (unsigned long) n);
+}
+
+static void bench_hash(size_t len, size_t rounds)
+{
+	char *key = json_malloc(len);
+	volatile uint32_t sink = 0;
+	clock_t start;
+	double secs;
+	size_t i;
+
+	memset(key, 'k', len);
+	start = clock();
+	for (i = 0; i < rounds; i++)
+	{
+		key[i % len] = (char) i;
+		sink ^= json_strnhash(key, len);
+	}
+	secs = check_seconds(start);
+	printf("  json_strnhash, %lu byte keys: %.1f ns each, %.0f MB/s\n",
+		(unsigned long) len, secs * 1e9 / rounds, len * rounds / secs / 1e6);
+	json_free(key);
+}
+
+// Seconds to look all of the keys up, `rounds` times over
+static double time_lookups(char **keys, size_t rounds)
+{
+	JSON_Object *obj = json_object_new();
+	clock_t start;
+	size_t i, r, found = 0;
+
+	for (i = 0; i < CHECK_NUM_KEYS; i++)
+		json_object_set(obj, keys[i], json_null());
+
+	start = clock();
+	for (r = 0; r < rounds; r++)
+	{
+		for (i = 0; i < CHECK_NUM_KEYS; i++)
+			found += (json_object_get_len(obj, keys[i], CHECK_KEY_LEN) != NULL);
+	}
+	check(found == rounds * CHECK_NUM_KEYS && obj->num_elements == CHECK_NUM_KEYS,
+		"every key is stored and found");
+
+	json_value_unref(obj);
+	return check_seconds(start);
+}
+
+static void check_colliding_keys(void)
+{
+	char **colliding = json_malloc(CHECK_NUM_KEYS * sizeof(char*));
+	char **plain = json_malloc(CHECK_NUM_KEYS * sizeof(char*));
+	size_t *chains = json_malloc(CHECK_NUM_KEYS * 2 * sizeof(size_t));
+	size_t i, longest = 0;
+	bool collide = true;
+	double crafted_secs, plain_secs;
+
+	for (i = 0; i < CHECK_NUM_KEYS; i++)
+	{
+		colliding[i] = json_malloc(CHECK_KEY_LEN + 1);
+		plain[i] = json_malloc(CHECK_KEY_LEN + 1);
+		check_colliding_key(colliding[i], i);
+		check_plain_key(plain[i], i);
+		collide = collide && (check_sdbm(colliding[i], CHECK_KEY_LEN) ==
+			check_sdbm(colliding[0], CHECK_KEY_LEN));
+	}
+	check(collide, "the crafted keys all collide under sdbm");
+
+	// Where probing starts for each key, in a table twice the number of keys
+	for (i = 0; i < CHECK_NUM_KEYS; i++)
+	{
+		size_t n = ++chains[json_strnhash(colliding[i], CHECK_KEY_LEN) &
+			(CHECK_NUM_KEYS * 2 - 1)];
+		if (n > longest)
+			longest = n;
+	}
+	printf("  most crafted keys starting at one slot: %lu of %lu\n",
+		(unsigned long) longest, (unsigned long) CHECK_NUM_KEYS);
+	check(longest <= 16, "the crafted keys don't share one probe chain");
+
+	crafted_secs = time_lookups(colliding, 20);
+	plain_secs = time_lookups(plain, 20);
+	printf("  lookups: %.3f s for crafted keys, %.3f s for plain keys\n",
+		crafted_secs, plain_secs);
+	check(crafted_secs < plain_secs * 4 + 0.05,
+		"looking up crafted keys is about as fast as plain keys");
+
+	for (i = 0; i < CHECK_NUM_KEYS; i++)
+	{
+		json_free(colliding[i]);
+		json_free(plain[i]);
+	}
+	json_free(colliding);
+	json_free(plain);
+	json_free(chains);
+}
+
+// Appending a packed array's own elements, which are views that appending
+// drops
+static void check_self_append(void)
+{
+	JSON_Array *arr = json_array_new_packed(JSON_ARRAY_KIND_INT64);
+	JSON_Value *values[2];
+
+	json_array_append(arr, json_number_new_int64(7));
+	json_array_append(arr, json_number_new_int64(8));
+	json_array_append(arr, json_array_nth(arr, 0));
+	values[0] = json_array_nth(arr, 1);
+	values[1] = json_array_nth(arr, 2);
+	json_array_append_many(arr, values, 2);
+	json_array_extend(arr, arr);
+
+	check(arr->size == 10 &&
+		json_number_get_int64(JSON_NUMBER(json_array_nth(arr, 7))) == 7 &&
+		json_number_get_int64(JSON_NUMBER(json_array_nth(arr, 8))) == 8 &&
+		json_number_get_int64(JSON_NUMBER(json_array_nth(arr, 9))) == 7,
+		"a packed array can have its own elements appended");
+
+	json_value_unref(arr);
+}
+
+// Writes `root` through the caches of the `n` containers in `cached`, then
+// again with their caches off, and checks the two agree. The caches are
+// turned back on and filled for the next change.
+static void check_cached_text(JSON_Value *root, JSON_Value **cached, size_t n,
+	const char *what)
+{
+	JSON_String *text, *fresh;
+	size_t i;
+
+	text = json_value_to_string_flags(root, 0, JSON_WRITE_FLAG_COMPACT);
+	for (i = 0; i < n; i++)
+		json_value_set_cached(cached[i], false);
+	fresh = json_value_to_string_flags(root, 0, JSON_WRITE_FLAG_COMPACT);
+	check(text != NULL && fresh != NULL &&
+		json_strequal(json_string_cstr(text), json_string_cstr(fresh)), what);
+
+	for (i = 0; i < n; i++)
+		json_value_set_cached(cached[i], true);
+	json_value_unref_many(text, fresh,
+		json_value_to_string_flags(root, 0, JSON_WRITE_FLAG_COMPACT), NULL);
+}
+
+// A change two levels below the top, with every level cached
+static void check_cache_nested(void)
+{
+	JSON_Object *root = json_object_new(), *inner = json_object_new();
+	JSON_Array *mid = json_array_new();
+	JSON_Value *cached[3];
+
+	json_object_set(inner, "b", json_number_new_int64(2));
+	json_array_append(mid, json_number_new_int64(1));
+	json_array_append(mid, inner);
+	json_object_set(root, "a", mid);
+	cached[0] = JSON_VALUE(root);
+	cached[1] = JSON_VALUE(mid);
+	cached[2] = JSON_VALUE(inner);
+	check_cached_text(JSON_VALUE(root), cached, 3, "cached text is written as is");
+
+	json_object_set(inner, "b", json_number_new_int64(3));
+	json_object_set(inner, "c", json_null());
+	check_cached_text(JSON_VALUE(root), cached, 3,
+		"cached text above a nested change is rebuilt");
+
+	json_value_unref(root);
+}
+
+// A child taken out, changed while it has no parent, and put back
+static void check_cache_reinsert(void)
+{
+	JSON_Array *root = json_array_new(), *child = json_array_new();
+	JSON_Value *cached[2];
+
+	json_array_append(child, json_number_new_int64(1));
+	json_array_append(root, json_boolean_true());
+	json_array_append(root, child);
+	cached[0] = JSON_VALUE(root);
+	cached[1] = JSON_VALUE(child);
+	check_cached_text(JSON_VALUE(root), cached, 2, "cached text is written as is");
+
+	child = JSON_ARRAY(json_array_pop_nth(root, 1));
+	check_cached_text(JSON_VALUE(root), cached, 1,
+		"cached text is rebuilt after a child is removed");
+
+	json_array_append(child, json_number_new_int64(2));
+	json_array_insert(root, JSON_VALUE(child), 0);
+	json_value_unref(child);
+	check_cached_text(JSON_VALUE(root), cached, 2,
+		"cached text is rebuilt after a changed child is put back");
+
+	json_array_append(child, json_number_new_int64(3));
+	check_cached_text(JSON_VALUE(root), cached, 2,
+		"a child put back still invalidates its new parent");
+
+	json_value_unref(root);
+}
+
+// A container that becomes shared while its parent's text is cached
+static void check_cache_shared(void)
+{
+	JSON_Array *p = json_array_new(), *q = json_array_new(), *d = json_array_new();
+	JSON_Value *cached[1];
+
+	json_array_append(d, json_number_new_int64(1));
+	json_array_append(p, d);
+	cached[0] = JSON_VALUE(p);
+	json_value_set_cached(p, true);
+	json_value_unref(json_value_to_string_flags(p, 0, JSON_WRITE_FLAG_COMPACT));
+
+	json_array_append(q, d);
+	json_array_append(d, json_number_new_int64(2));
+	check_cached_text(JSON_VALUE(p), cached, 1,
+		"cached text above a container that became shared is rebuilt");
+
+	json_value_unref(p);
+	json_value_unref(q);
+}
+
+// Writes `v` as RFC 8785 canonical JSON and compares it with `expected`
+static void check_canonical(void *v, const char *expected, const char *what)
+{
+	char *text = json_value_serialize(v, JSON_WRITE_FLAG_CANONICAL, NULL);
+
+	check(text != NULL && json_strequal(text, expected), what);
+	if (text != NULL && !json_strequal(text, expected))
+		printf("  got %s, expected %s\n", text, expected);
+
+	json_free(text);
+	json_value_unref(v);
+}
+
+static void check_canonical_output(void)
+{
+	JSON_Object *obj = json_object_new();
+
+	check_canonical(json_number_new(1e23), "1e+23", "canonical 1e23");
+	check_canonical(json_number_new(-0.0), "0", "canonical -0");
+	check_canonical(json_number_new(1e-6), "0.000001", "canonical 1e-6");
+	check_canonical(json_number_new(1e-7), "1e-7", "canonical 1e-7");
+	check_canonical(json_number_new(1e21), "1e+21", "canonical 1e21");
+	check_canonical(json_number_new(1e20), "100000000000000000000",
+		"canonical 1e20");
+	check_canonical(json_number_new(9.999999999999997e22),
+		"9.999999999999997e+22", "canonical 9.999999999999997e22");
+
+	// U+20AC, U+1F600 and U+FB01 sort by UTF-16 code units, which puts the
+	// surrogate pair of U+1F600 before U+FB01 unlike their UTF-8 bytes
+	json_object_set(obj, "\xef\xac\x81", json_number_new_int64(5));
+	json_object_set(obj, "\xf0\x9f\x98\x80", json_number_new_int64(4));
+	json_object_set(obj, "\xe2\x82\xac", json_number_new_int64(3));
+	json_object_set(obj, "b", json_number_new_int64(2));
+	json_object_set(obj, "a", json_number_new_int64(1));
+	check_canonical(obj,
+		"{\"a\":1,\"b\":2,\"\xe2\x82\xac\":3,"
+		"\"\xf0\x9f\x98\x80\":4,\"\xef\xac\x81\":5}",
+		"canonical members sort by UTF-16 code units");
+}
+
+int main()
+{
+	bench_hash(8, 20000000);
+	bench_hash(32, 10000000);
+	bench_hash(1024, 500000);
+
+	check_colliding_keys();
+	check_self_append();
+	check_cache_nested();
+	check_cache_reinsert();
+	check_cache_shared();
+	check_canonical_output();
+
+	return (check_failures == 0) ? 0 : 1;
+}
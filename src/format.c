@@ -0,0 +1,744 @@
+#include "format.h"
+#include <math.h>
+
+// Pairs of digits, so that integers are formatted two digits per division
+static const char json_format_digits[] =
+	"00010203040506070809" "10111213141516171819"
+	"20212223242526272829" "30313233343536373839"
+	"40414243444546474849" "50515253545556575859"
+	"60616263646566676869" "70717273747576777879"
+	"80818283848586878889" "90919293949596979899";
+
+// Writes the digits of `value` backwards from `end`, returns the first one
+static char *json_format_uint64_backwards(char *end, uint64_t value)
+{
+	unsigned i;
+
+	while (value >= 100)
+	{
+		i = (unsigned)(value % 100) * 2;
+		value /= 100;
+		*--end = json_format_digits[i + 1];
+		*--end = json_format_digits[i];
+	}
+
+	if (value >= 10)
+	{
+		i = (unsigned) value * 2;
+		*--end = json_format_digits[i + 1];
+		*--end = json_format_digits[i];
+	}
+	else
+		*--end = (char)('0' + value);
+
+	return end;
+}
+
+size_t json_format_int64(char *buf, int64_t value)
+{
+	char digits[JSON_FORMAT_INT64_SIZE];
+	char *end = digits + sizeof(digits), *start;
+	uint64_t abs_value = (uint64_t) value;
+	size_t n = 0;
+
+	if (value < 0)
+	{
+		buf[n++] = '-';
+		abs_value = 0 - abs_value;
+	}
+
+	start = json_format_uint64_backwards(end, abs_value);
+	memcpy(buf + n, start, end - start);
+	return n + (end - start);
+}
+
+// Doubles are printed with the fewest digits that still read back as the
+// same value, using Grisu2: the value and the boundaries halfway to its
+// neighbours are scaled by a cached power of ten into a range where digits
+// can be generated with 64-bit integer arithmetic, and digits are emitted
+// until the result is inside the boundaries. It's shortest for all but a
+// tiny fraction of values, and round-trips for all of them.
+// Source: Florian Loitsch, "Printing Floating-Point Numbers Quickly and
+// Accurately with Integers", PLDI 2010
+
+// A 64-bit significand and binary exponent, f * 2^e
+struct JSON_DiyFp
+{
+	uint64_t f;
+	int e;
+};
+
+struct JSON_CachedPower
+{
+	uint64_t f;
+	int e;
+	int k;
+};
+
+// Normalized 10^k for every 8th k from -300 to 324
+static const struct JSON_CachedPower json_format_cached_powers[] =
+{
+	{ 0xAB70FE17C79AC6CAULL, -1060, -300 },
+	{ 0xFF77B1FCBEBCDC4FULL, -1034, -292 },
+	{ 0xBE5691EF416BD60CULL, -1007, -284 },
+	{ 0x8DD01FAD907FFC3CULL,  -980, -276 },
+	{ 0xD3515C2831559A83ULL,  -954, -268 },
+	{ 0x9D71AC8FADA6C9B5ULL,  -927, -260 },
+	{ 0xEA9C227723EE8BCBULL,  -901, -252 },
+	{ 0xAECC49914078536DULL,  -874, -244 },
+	{ 0x823C12795DB6CE57ULL,  -847, -236 },
+	{ 0xC21094364DFB5637ULL,  -821, -228 },
+	{ 0x9096EA6F3848984FULL,  -794, -220 },
+	{ 0xD77485CB25823AC7ULL,  -768, -212 },
+	{ 0xA086CFCD97BF97F4ULL,  -741, -204 },
+	{ 0xEF340A98172AACE5ULL,  -715, -196 },
+	{ 0xB23867FB2A35B28EULL,  -688, -188 },
+	{ 0x84C8D4DFD2C63F3BULL,  -661, -180 },
+	{ 0xC5DD44271AD3CDBAULL,  -635, -172 },
+	{ 0x936B9FCEBB25C996ULL,  -608, -164 },
+	{ 0xDBAC6C247D62A584ULL,  -582, -156 },
+	{ 0xA3AB66580D5FDAF6ULL,  -555, -148 },
+	{ 0xF3E2F893DEC3F126ULL,  -529, -140 },
+	{ 0xB5B5ADA8AAFF80B8ULL,  -502, -132 },
+	{ 0x87625F056C7C4A8BULL,  -475, -124 },
+	{ 0xC9BCFF6034C13053ULL,  -449, -116 },
+	{ 0x964E858C91BA2655ULL,  -422, -108 },
+	{ 0xDFF9772470297EBDULL,  -396, -100 },
+	{ 0xA6DFBD9FB8E5B88FULL,  -369,  -92 },
+	{ 0xF8A95FCF88747D94ULL,  -343,  -84 },
+	{ 0xB94470938FA89BCFULL,  -316,  -76 },
+	{ 0x8A08F0F8BF0F156BULL,  -289,  -68 },
+	{ 0xCDB02555653131B6ULL,  -263,  -60 },
+	{ 0x993FE2C6D07B7FACULL,  -236,  -52 },
+	{ 0xE45C10C42A2B3B06ULL,  -210,  -44 },
+	{ 0xAA242499697392D3ULL,  -183,  -36 },
+	{ 0xFD87B5F28300CA0EULL,  -157,  -28 },
+	{ 0xBCE5086492111AEBULL,  -130,  -20 },
+	{ 0x8CBCCC096F5088CCULL,  -103,  -12 },
+	{ 0xD1B71758E219652CULL,   -77,   -4 },
+	{ 0x9C40000000000000ULL,   -50,    4 },
+	{ 0xE8D4A51000000000ULL,   -24,   12 },
+	{ 0xAD78EBC5AC620000ULL,     3,   20 },
+	{ 0x813F3978F8940984ULL,    30,   28 },
+	{ 0xC097CE7BC90715B3ULL,    56,   36 },
+	{ 0x8F7E32CE7BEA5C70ULL,    83,   44 },
+	{ 0xD5D238A4ABE98068ULL,   109,   52 },
+	{ 0x9F4F2726179A2245ULL,   136,   60 },
+	{ 0xED63A231D4C4FB27ULL,   162,   68 },
+	{ 0xB0DE65388CC8ADA8ULL,   189,   76 },
+	{ 0x83C7088E1AAB65DBULL,   216,   84 },
+	{ 0xC45D1DF942711D9AULL,   242,   92 },
+	{ 0x924D692CA61BE758ULL,   269,  100 },
+	{ 0xDA01EE641A708DEAULL,   295,  108 },
+	{ 0xA26DA3999AEF774AULL,   322,  116 },
+	{ 0xF209787BB47D6B85ULL,   348,  124 },
+	{ 0xB454E4A179DD1877ULL,   375,  132 },
+	{ 0x865B86925B9BC5C2ULL,   402,  140 },
+	{ 0xC83553C5C8965D3DULL,   428,  148 },
+	{ 0x952AB45CFA97A0B3ULL,   455,  156 },
+	{ 0xDE469FBD99A05FE3ULL,   481,  164 },
+	{ 0xA59BC234DB398C25ULL,   508,  172 },
+	{ 0xF6C69A72A3989F5CULL,   534,  180 },
+	{ 0xB7DCBF5354E9BECEULL,   561,  188 },
+	{ 0x88FCF317F22241E2ULL,   588,  196 },
+	{ 0xCC20CE9BD35C78A5ULL,   614,  204 },
+	{ 0x98165AF37B2153DFULL,   641,  212 },
+	{ 0xE2A0B5DC971F303AULL,   667,  220 },
+	{ 0xA8D9D1535CE3B396ULL,   694,  228 },
+	{ 0xFB9B7CD9A4A7443CULL,   720,  236 },
+	{ 0xBB764C4CA7A44410ULL,   747,  244 },
+	{ 0x8BAB8EEFB6409C1AULL,   774,  252 },
+	{ 0xD01FEF10A657842CULL,   800,  260 },
+	{ 0x9B10A4E5E9913129ULL,   827,  268 },
+	{ 0xE7109BFBA19C0C9DULL,   853,  276 },
+	{ 0xAC2820D9623BF429ULL,   880,  284 },
+	{ 0x80444B5E7AA7CF85ULL,   907,  292 },
+	{ 0xBF21E44003ACDD2DULL,   933,  300 },
+	{ 0x8E679C2F5E44FF8FULL,   960,  308 },
+	{ 0xD433179D9C8CB841ULL,   986,  316 },
+	{ 0x9E19DB92B4E31BA9ULL,  1013,  324 }
+};
+
+#define JSON_FORMAT_MIN_CACHED_EXP -300
+#define JSON_FORMAT_CACHED_EXP_STEP 8
+
+// The range the scaled binary exponent has to land in
+#define JSON_FORMAT_ALPHA -60
+#define JSON_FORMAT_GAMMA -32
+
+static inline struct JSON_DiyFp json_diy_fp(uint64_t f, int e)
+{
+	struct JSON_DiyFp x;
+	x.f = f;
+	x.e = e;
+	return x;
+}
+
+// The upper 64 bits of the product, rounded
+static struct JSON_DiyFp json_diy_fp_mul(struct JSON_DiyFp x, struct JSON_DiyFp y)
+{
+	uint64_t a = x.f >> 32, b = x.f & 0xFFFFFFFFu;
+	uint64_t c = y.f >> 32, d = y.f & 0xFFFFFFFFu;
+	uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+	uint64_t mid = (bd >> 32) + (ad & 0xFFFFFFFFu) + (bc & 0xFFFFFFFFu);
+
+	mid += 1u << 31;
+	return json_diy_fp(ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64);
+}
+
+static struct JSON_DiyFp json_diy_fp_normalize(struct JSON_DiyFp x)
+{
+	while (!(x.f >> 63))
+	{
+		x.f <<= 1;
+		x.e--;
+	}
+	return x;
+}
+
+// Splits a positive, finite `value` into its normalized significand `w`
+// and the boundaries `minus` and `plus` halfway to its neighbours, which
+// share w's exponent
+static void json_format_boundaries(double value, struct JSON_DiyFp *minus,
+	struct JSON_DiyFp *w, struct JSON_DiyFp *plus)
+{
+	const uint64_t hidden_bit = (uint64_t) 1 << 52;
+	struct JSON_DiyFp v, m_plus, m_minus;
+	uint64_t bits, fraction;
+	int exponent;
+
+	memcpy(&bits, &value, sizeof(bits));
+	fraction = bits & (hidden_bit - 1);
+	exponent = (int)(bits >> 52);
+
+	if (exponent == 0)
+		v = json_diy_fp(fraction, 1 - 1075);
+	else
+		v = json_diy_fp(fraction + hidden_bit, exponent - 1075);
+
+	// At a power of two the gap to the next smaller value is half as big
+	m_plus = json_diy_fp(2 * v.f + 1, v.e - 1);
+	if (fraction == 0 && exponent > 1)
+		m_minus = json_diy_fp(4 * v.f - 1, v.e - 2);
+	else
+		m_minus = json_diy_fp(2 * v.f - 1, v.e - 1);
+
+	*plus = json_diy_fp_normalize(m_plus);
+	*minus = json_diy_fp(m_minus.f << (m_minus.e - plus->e), plus->e);
+	*w = json_diy_fp_normalize(v);
+}
+
+// Picks a 10^-k that scales a number with binary exponent `e` into
+// [ALPHA, GAMMA]
+static const struct JSON_CachedPower *json_format_cached_power(int e)
+{
+	// ceil((ALPHA - e - 1) * log10(2))
+	int f = JSON_FORMAT_ALPHA - e - 1;
+	int k = (f * 78913) / (1 << 18) + (f > 0);
+	int index = (-JSON_FORMAT_MIN_CACHED_EXP + k + (JSON_FORMAT_CACHED_EXP_STEP - 1)) /
+		JSON_FORMAT_CACHED_EXP_STEP;
+
+	assert(index >= 0);
+	assert((size_t) index < sizeof(json_format_cached_powers) /
+		sizeof(json_format_cached_powers[0]));
+	return &json_format_cached_powers[index];
+}
+
+// The largest power of ten not above `n`, and its number of digits
+static int json_format_largest_pow10(uint32_t n, uint32_t *pow10)
+{
+	static const uint32_t pows[] =
+	{
+		1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000,
+		1000000000,
+	};
+	int i = 9;
+
+	while (i > 0 && n < pows[i])
+		i--;
+	*pow10 = pows[i];
+	return i + 1;
+}
+
+// Moves the last digit towards w while that stays inside the boundaries
+static void json_format_round(char *buf, int len, uint64_t dist, uint64_t delta,
+	uint64_t rest, uint64_t ten_k)
+{
+	while (rest < dist && delta - rest >= ten_k &&
+	       (rest + ten_k < dist || dist - rest > rest + ten_k - dist))
+	{
+		buf[len - 1]--;
+		rest += ten_k;
+	}
+}
+
+// Generates the digits of w, scaled, stopping as soon as they're within
+// [minus, plus]
+static int json_format_digit_gen(char *buf, int *exp10, struct JSON_DiyFp minus,
+	struct JSON_DiyFp w, struct JSON_DiyFp plus)
+{
+	uint64_t delta = plus.f - minus.f;
+	uint64_t dist = plus.f - w.f;
+	int shift = -plus.e;
+	uint64_t one = (uint64_t) 1 << shift;
+	uint32_t p1 = (uint32_t)(plus.f >> shift);
+	uint64_t p2 = plus.f & (one - 1);
+	uint32_t pow10;
+	uint64_t rest;
+	int len = 0, n, m = 0;
+
+	// The integral part first
+	n = json_format_largest_pow10(p1, &pow10);
+	while (n > 0)
+	{
+		buf[len++] = (char)('0' + p1 / pow10);
+		p1 %= pow10;
+		n--;
+		rest = ((uint64_t) p1 << shift) + p2;
+		if (rest <= delta)
+		{
+			*exp10 += n;
+			json_format_round(buf, len, dist, delta, rest, (uint64_t) pow10 << shift);
+			return len;
+		}
+		pow10 /= 10;
+	}
+
+	// Then the fraction
+	for (;;)
+	{
+		p2 *= 10;
+		buf[len++] = (char)('0' + (p2 >> shift));
+		p2 &= one - 1;
+		m++;
+		delta *= 10;
+		dist *= 10;
+		if (p2 <= delta)
+			break;
+	}
+
+	*exp10 -= m;
+	json_format_round(buf, len, dist, delta, p2, one);
+	return len;
+}
+
+// The shortest digits of a positive, finite `value`, so that it equals
+// digits * 10^exp10
+static int json_format_grisu2(char *buf, int *exp10, double value)
+{
+	struct JSON_DiyFp minus, w, plus, c;
+	const struct JSON_CachedPower *cached;
+
+	json_format_boundaries(value, &minus, &w, &plus);
+
+	cached = json_format_cached_power(plus.e);
+	c = json_diy_fp(cached->f, cached->e);
+
+	w = json_diy_fp_mul(w, c);
+	minus = json_diy_fp_mul(minus, c);
+	plus = json_diy_fp_mul(plus, c);
+
+	// The products are off by up to one ulp, so stay on the safe side
+	minus.f++;
+	plus.f--;
+
+	*exp10 = -cached->k;
+	return json_format_digit_gen(buf, exp10, minus, w, plus);
+}
+
+// Grisu2 isn't always shortest and can pick other than the closest of the
+// shortest, while canonical output has to be exactly what ECMAScript would
+// print. Canonical digits come from the exact algorithm instead, which
+// does its arithmetic on big integers.
+// Source: Robert G. Burger and R. Kent Dybvig, "Printing Floating-Point
+// Numbers Quickly and Accurately", PLDI 1996
+
+// Enough for the scaled value of any double, about 2^1140 at the most
+#define JSON_BIGNUM_WORDS 40
+
+struct JSON_Bignum
+{
+	uint32_t words[JSON_BIGNUM_WORDS];
+	int len;
+};
+
+static void json_bignum_set(struct JSON_Bignum *a, uint64_t value)
+{
+	a->len = 0;
+	while (value != 0)
+	{
+		a->words[a->len++] = (uint32_t) value;
+		value >>= 32;
+	}
+}
+
+static void json_bignum_mul_small(struct JSON_Bignum *a, uint32_t m)
+{
+	uint64_t carry = 0;
+	int i;
+
+	for (i = 0; i < a->len; i++)
+	{
+		carry += (uint64_t) a->words[i] * m;
+		a->words[i] = (uint32_t) carry;
+		carry >>= 32;
+	}
+	if (carry != 0)
+	{
+		assert(a->len < JSON_BIGNUM_WORDS);
+		a->words[a->len++] = (uint32_t) carry;
+	}
+}
+
+static void json_bignum_mul_pow10(struct JSON_Bignum *a, int n)
+{
+	for (; n >= 9; n -= 9)
+		json_bignum_mul_small(a, 1000000000);
+	for (; n > 0; n--)
+		json_bignum_mul_small(a, 10);
+}
+
+static void json_bignum_shift_left(struct JSON_Bignum *a, int n)
+{
+	int words = n / 32, bits = n % 32, i;
+
+	if (a->len == 0)
+		return;
+
+	assert(a->len + words < JSON_BIGNUM_WORDS);
+
+	a->words[a->len] = 0;
+	for (i = a->len; i >= 0; i--)
+	{
+		uint32_t w = a->words[i];
+		a->words[i + words] = (bits == 0) ? w : (w << bits) |
+			((i > 0) ? (a->words[i - 1] >> (32 - bits)) : 0);
+	}
+	for (i = 0; i < words; i++)
+		a->words[i] = 0;
+
+	a->len += words + 1;
+	while (a->len > 0 && a->words[a->len - 1] == 0)
+		a->len--;
+}
+
+static int json_bignum_compare(const struct JSON_Bignum *a, const struct JSON_Bignum *b)
+{
+	int i;
+
+	if (a->len != b->len)
+		return (a->len > b->len) ? 1 : -1;
+	for (i = a->len - 1; i >= 0; i--)
+	{
+		if (a->words[i] != b->words[i])
+			return (a->words[i] > b->words[i]) ? 1 : -1;
+	}
+	return 0;
+}
+
+static void json_bignum_add(struct JSON_Bignum *out, const struct JSON_Bignum *a,
+	const struct JSON_Bignum *b)
+{
+	uint64_t carry = 0;
+	int i, len = (a->len > b->len) ? a->len : b->len;
+
+	for (i = 0; i < len; i++)
+	{
+		carry += (uint64_t)((i < a->len) ? a->words[i] : 0) +
+			((i < b->len) ? b->words[i] : 0);
+		out->words[i] = (uint32_t) carry;
+		carry >>= 32;
+	}
+	if (carry != 0)
+	{
+		assert(len < JSON_BIGNUM_WORDS);
+		out->words[len++] = (uint32_t) carry;
+	}
+	out->len = len;
+}
+
+// a -= b, where b <= a
+static void json_bignum_sub(struct JSON_Bignum *a, const struct JSON_Bignum *b)
+{
+	int64_t borrow = 0;
+	int i;
+
+	for (i = 0; i < a->len; i++)
+	{
+		borrow += (int64_t) a->words[i] - ((i < b->len) ? b->words[i] : 0);
+		a->words[i] = (uint32_t) borrow;
+		borrow = (borrow < 0) ? -1 : 0;
+	}
+	while (a->len > 0 && a->words[a->len - 1] == 0)
+		a->len--;
+}
+
+// Whether r + m_plus reaches s, which is past the upper boundary
+static bool json_bignum_high(const struct JSON_Bignum *r, const struct JSON_Bignum *m_plus,
+	const struct JSON_Bignum *s, bool inclusive)
+{
+	struct JSON_Bignum sum;
+	int cmp;
+
+	json_bignum_add(&sum, r, m_plus);
+	cmp = json_bignum_compare(&sum, s);
+	return inclusive ? (cmp >= 0) : (cmp > 0);
+}
+
+// Writes the shortest digits that read back as the positive, finite
+// `value`, the closest of them if there's a choice. Their decimal point is
+// `*point` digits in.
+static int json_format_exact(char *buf, int *point, double value)
+{
+	const uint64_t hidden_bit = (uint64_t) 1 << 52;
+	struct JSON_Bignum r, s, m_plus, m_minus;
+	uint64_t bits, f;
+	int e, k, len = 0, digit, exponent;
+	bool even, low, high;
+	double estimate;
+
+	memcpy(&bits, &value, sizeof(bits));
+	f = bits & (hidden_bit - 1);
+	exponent = (int)(bits >> 52);
+	if (exponent == 0)
+		e = 1 - 1075;
+	else
+	{
+		f += hidden_bit;
+		e = exponent - 1075;
+	}
+
+	// Values halfway to a neighbour read back as `value` when its
+	// significand is even, ties going to even
+	even = (f % 2) == 0;
+
+	// value = r / s, with the boundaries at (r - m_minus) / s and
+	// (r + m_plus) / s. At a power of two the gap below is half as big.
+	json_bignum_set(&r, f);
+	json_bignum_set(&m_plus, 1);
+	json_bignum_set(&m_minus, 1);
+	json_bignum_set(&s, 1);
+	if (e >= 0)
+	{
+		json_bignum_shift_left(&r, e + 1);
+		json_bignum_shift_left(&m_plus, e);
+		json_bignum_shift_left(&m_minus, e);
+		json_bignum_shift_left(&s, 1);
+	}
+	else
+	{
+		json_bignum_shift_left(&r, 1);
+		json_bignum_shift_left(&s, 1 - e);
+	}
+	if (f == hidden_bit && exponent > 1)
+	{
+		json_bignum_shift_left(&r, 1);
+		json_bignum_shift_left(&m_plus, 1);
+		json_bignum_shift_left(&s, 1);
+	}
+
+	// k = ceil(log10(value)), or one less, from the binary exponent
+	for (len = 0; (f >> len) > 1; len++)
+		;
+	estimate = (e + len) * 0.30102999566398114 - 1e-10;
+	k = (int) estimate;
+	if (estimate > k)
+		k++;
+
+	if (k >= 0)
+		json_bignum_mul_pow10(&s, k);
+	else
+	{
+		json_bignum_mul_pow10(&r, -k);
+		json_bignum_mul_pow10(&m_plus, -k);
+		json_bignum_mul_pow10(&m_minus, -k);
+	}
+
+	if (json_bignum_high(&r, &m_plus, &s, even))
+		k++;
+	else
+	{
+		json_bignum_mul_small(&r, 10);
+		json_bignum_mul_small(&m_plus, 10);
+		json_bignum_mul_small(&m_minus, 10);
+	}
+	*point = k;
+
+	for (len = 0;;)
+	{
+		// r < 10 * s, so there are at most 9 subtractions
+		digit = 0;
+		while (json_bignum_compare(&r, &s) >= 0)
+		{
+			json_bignum_sub(&r, &s);
+			digit++;
+		}
+
+		low = even ? (json_bignum_compare(&r, &m_minus) <= 0) :
+			(json_bignum_compare(&r, &m_minus) < 0);
+		high = json_bignum_high(&r, &m_plus, &s, even);
+
+		if (low || high)
+		{
+			if (low && high)
+			{
+				// The closer of the two, the even one on a tie
+				json_bignum_shift_left(&r, 1);
+				k = json_bignum_compare(&r, &s);
+				if (k > 0 || (k == 0 && digit % 2 != 0))
+					digit++;
+			}
+			else if (high)
+				digit++;
+			buf[len++] = (char)('0' + digit);
+			return len;
+		}
+
+		buf[len++] = (char)('0' + digit);
+		json_bignum_mul_small(&r, 10);
+		json_bignum_mul_small(&m_plus, 10);
+		json_bignum_mul_small(&m_minus, 10);
+	}
+}
+
+static size_t json_format_exponent(char *buf, int e)
+{
+	size_t n = 0;
+
+	if (e < 0)
+	{
+		buf[n++] = '-';
+		e = -e;
+	}
+	else
+		buf[n++] = '+';
+
+	if (e >= 100)
+	{
+		buf[n++] = (char)('0' + e / 100);
+		e %= 100;
+		buf[n++] = json_format_digits[e * 2];
+		buf[n++] = json_format_digits[e * 2 + 1];
+	}
+	else if (e >= 10)
+	{
+		buf[n++] = json_format_digits[e * 2];
+		buf[n++] = json_format_digits[e * 2 + 1];
+	}
+	else
+		buf[n++] = (char)('0' + e);
+
+	return n;
+}
+
+// Lays out `len` digits in `buf` whose decimal point is `point` digits in:
+// plainly while the point is within (-4, 15], otherwise in exponent form.
+// Whole numbers keep a ".0" so they still read back as doubles. Canonical
+// layout is the one ECMAScript's Number.prototype.toString() uses, plain
+// within (-6, 21] and whole numbers without a fraction.
+static size_t json_format_layout(char *buf, int len, int point, bool canonical)
+{
+	int min_point = canonical ? -6 : -4, max_point = canonical ? 21 : 15;
+
+	if (len <= point && point <= max_point)
+	{
+		// 1234000.0
+		memset(buf + len, '0', point - len);
+		if (canonical)
+			return point;
+		buf[point] = '.';
+		buf[point + 1] = '0';
+		return point + 2;
+	}
+	else if (0 < point && point <= max_point)
+	{
+		// 12.34
+		memmove(buf + point + 1, buf + point, len - point);
+		buf[point] = '.';
+		return len + 1;
+	}
+	else if (min_point < point && point <= 0)
+	{
+		// 0.0001234
+		memmove(buf + 2 - point, buf, len);
+		buf[0] = '0';
+		buf[1] = '.';
+		memset(buf + 2, '0', -point);
+		return 2 - point + len;
+	}
+
+	// 1.234e+56
+	if (len > 1)
+	{
+		memmove(buf + 2, buf + 1, len - 1);
+		buf[1] = '.';
+		len++;
+	}
+	buf[len++] = 'e';
+	return len + json_format_exponent(buf + len, point - 1);
+}
+
+// NaN and the infinities have no JSON representation and are written as
+// null
+size_t json_format_double(char *buf, double value)
+{
+	size_t n = 0;
+	int len, exp10;
+
+	if (value != value || value - value != 0.0)
+	{
+		memcpy(buf, "null", 4);
+		return 4;
+	}
+
+	if (signbit(value))
+	{
+		buf[n++] = '-';
+		value = -value;
+	}
+
+	if (value == 0.0)
+	{
+		memcpy(buf + n, "0.0", 3);
+		return n + 3;
+	}
+
+	len = json_format_grisu2(buf + n, &exp10, value);
+	return n + json_format_layout(buf + n, len, len + exp10, false);
+}
+
+// The RFC 8785 form of a number, which is how ECMAScript prints it: no
+// negative zero and no ".0" on whole numbers. There is none for NaN and
+// the infinities, for which nothing is written and 0 returned.
+size_t json_format_double_canonical(char *buf, double value)
+{
+	size_t n = 0;
+	int len, point;
+
+	if (value != value || value - value != 0.0)
+		return 0;
+
+	if (value == 0.0)
+	{
+		buf[0] = '0';
+		return 1;
+	}
+	else if (value < 0.0)
+	{
+		buf[n++] = '-';
+		value = -value;
+	}
+
+	len = json_format_exact(buf + n, &point, value);
+	return n + json_format_layout(buf + n, len, point, true);
+}
+
+// Integers are numbers like any other to RFC 8785, so ones beyond what a
+// double holds exactly are rounded like one
+size_t json_format_int64_canonical(char *buf, int64_t value)
+{
+	const int64_t exact = (int64_t) 1 << 53;
+	if (-exact <= value && value <= exact)
+		return json_format_int64(buf, value);
+	return json_format_double_canonical(buf, (double) value);
+}
@@ -0,0 +1,27 @@
+#ifndef JSON_FORMAT_H_
+#define JSON_FORMAT_H_
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Number formatting that writes straight into a caller's buffer, without
+// printf and without looking at the locale. Neither terminates the text,
+// both return its length.
+
+// Enough for any int64_t and any double
+#define JSON_FORMAT_INT64_SIZE  20
+#define JSON_FORMAT_DOUBLE_SIZE 32
+
+size_t json_format_int64(char *buf, int64_t value);
+size_t json_format_double(char *buf, double value);
+size_t json_format_int64_canonical(char *buf, int64_t value);
+size_t json_format_double_canonical(char *buf, double value);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // JSON_FORMAT_H_
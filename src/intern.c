@@ -0,0 +1,142 @@
+#include "intern.h"
+#include "value.h"
+
+#define JSON_INTERN_INITIAL_NUM_BUCKETS 64
+
+struct JSON_InternedString
+{
+	struct JSON_InternedString *next;
+	size_t ref_count;
+	uint32_t hash;
+	uint32_t len;
+	char str[];
+};
+
+#define json_interned_string(s) \
+	((struct JSON_InternedString*)((char*)(s) - offsetof(struct JSON_InternedString, str)))
+
+static struct JSON_InternTable
+{
+	struct JSON_InternedString **buckets;
+	size_t num_buckets;
+	size_t num_elements;
+	JSON_Mutex lock;
+}
+json_intern_table = { NULL, 0, 0, JSON_MUTEX_INIT };
+
+// Rechain everything into twice as many buckets using the cached hashes
+static void json_intern_grow(struct JSON_InternTable *table)
+{
+	struct JSON_InternedString **buckets;
+	size_t i, num_buckets;
+
+	num_buckets = table->num_buckets ? (table->num_buckets * 2) :
+		JSON_INTERN_INITIAL_NUM_BUCKETS;
+	buckets = json_malloc(num_buckets * sizeof(struct JSON_InternedString*));
+
+	for (i = 0; i < table->num_buckets; i++)
+	{
+		struct JSON_InternedString *s = table->buckets[i], *next;
+		for (; s != NULL; s = next)
+		{
+			size_t n = s->hash & (num_buckets - 1);
+			next = s->next;
+			s->next = buckets[n];
+			buckets[n] = s;
+		}
+	}
+
+	if (table->buckets != NULL)
+		json_free(table->buckets);
+	table->buckets = buckets;
+	table->num_buckets = num_buckets;
+}
+
+// Returns a new reference to the interned copy of `str`, which is `len`
+// bytes long and hashes to `hash` with json_strnhash()
+const char *json_intern(const char *str, size_t len, uint32_t hash)
+{
+	struct JSON_InternTable *table = &json_intern_table;
+	struct JSON_InternedString *s;
+	size_t n;
+
+	assert(str != NULL);
+	assert(len <= UINT32_MAX);
+
+	json_mutex_lock(&table->lock);
+
+	if (table->num_buckets > 0)
+	{
+		for (s = table->buckets[hash & (table->num_buckets - 1)]; s != NULL; s = s->next)
+		{
+			if (s->hash == hash && s->len == len && memcmp(s->str, str, len) == 0)
+			{
+				s->ref_count++;
+				json_mutex_unlock(&table->lock);
+				return s->str;
+			}
+		}
+	}
+
+	if (table->num_elements >= table->num_buckets)
+		json_intern_grow(table);
+
+	s = json_malloc(sizeof(struct JSON_InternedString) + len + 1);
+	s->ref_count = 1;
+	s->hash = hash;
+	s->len = (uint32_t) len;
+	memcpy(s->str, str, len);
+	s->str[len] = '\0';
+
+	n = hash & (table->num_buckets - 1);
+	s->next = table->buckets[n];
+	table->buckets[n] = s;
+	table->num_elements++;
+
+	json_mutex_unlock(&table->lock);
+
+	return s->str;
+}
+
+const char *json_intern_ref(const char *str)
+{
+	assert(str != NULL);
+	json_mutex_lock(&json_intern_table.lock);
+	json_interned_string(str)->ref_count++;
+	json_mutex_unlock(&json_intern_table.lock);
+	return str;
+}
+
+void json_intern_unref(const char *str)
+{
+	struct JSON_InternTable *table = &json_intern_table;
+	struct JSON_InternedString *s, **link;
+
+	assert(str != NULL);
+
+	json_mutex_lock(&table->lock);
+
+	s = json_interned_string(str);
+	assert(s->ref_count > 0);
+	if (--s->ref_count == 0)
+	{
+		link = &table->buckets[s->hash & (table->num_buckets - 1)];
+		while (*link != s)
+			link = &(*link)->next;
+		*link = s->next;
+		table->num_elements--;
+		json_free(s);
+	}
+
+	json_mutex_unlock(&table->lock);
+}
+
+// Number of distinct strings currently interned
+size_t json_intern_count(void)
+{
+	size_t count;
+	json_mutex_lock(&json_intern_table.lock);
+	count = json_intern_table.num_elements;
+	json_mutex_unlock(&json_intern_table.lock);
+	return count;
+}
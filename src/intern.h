@@ -0,0 +1,25 @@
+#ifndef JSON_INTERN_H_
+#define JSON_INTERN_H_
+
+#include "util.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Object keys are interned: each distinct key is stored once for the
+// whole process with a reference count, and every object using it shares
+// that copy. Two interned strings are equal only if they're the same
+// pointer. The strings are NUL-terminated and must never be modified.
+// With JSON_ENABLE_THREADS the table is safe to use from any thread.
+
+const char *json_intern(const char *str, size_t len, uint32_t hash);
+const char *json_intern_ref(const char *str);
+void json_intern_unref(const char *str);
+size_t json_intern_count(void);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // JSON_INTERN_H_
@@ -6,6 +6,8 @@ extern "C" {
 #endif
 
 #include "util.h"
+#include "intern.h"
+#include "format.h"
 #include "value.h"
 #include "null.h"
 #include "boolean.h"
@@ -13,6 +15,10 @@ extern "C" {
 #include "string.h"
 #include "array.h"
 #include "object.h"
+#include "sink.h"
+#include "writer.h"
+#include "cache.h"
+#include "parallel.h"
 
 #ifdef __cplusplus
 } // extern "C"
@@ -8,6 +8,7 @@ static void json_lexer_free(JSON_Value *value)
 	assert(JSON_IS_LEXER(lex));
 	json_value_unref(lex->str);
 	json_value_unref(lex->value);
+	json_value_unref(&lex->number);
 	lex->offset = 0;
 	lex->lastchar = 0;
 }
@@ -17,6 +18,7 @@ static JSON_Lexer *json_lexer_new_internal(void)
 	JSON_Lexer *lex = json_value_alloc(JSON_TYPE_LEXER);
 	lex->str = json_string_new("");
 	lex->value = json_string_new("");
+	json_number_init(&lex->number);
 	lex->lastchar = JSON_LEXER_ERROR;
 	return lex;
 }
@@ -48,7 +50,6 @@ JSON_Lexer *json_lexer_new_from_cstr_length(const char *input_str, size_t len)
 JSON_Lexer *json_lexer_new_from_stream(FILE *fp)
 {// FIXME: error checking
 	size_t len;
-	char *temp;
 	JSON_Lexer *lex;
 
 	fseek(fp, 0, SEEK_END);
@@ -56,12 +57,10 @@ JSON_Lexer *json_lexer_new_from_stream(FILE *fp)
 	fseek(fp, 0, SEEK_SET);
 
 	lex = json_lexer_new_internal();
-	temp = json_realloc(lex->str->str, len + 1);
-	if (temp != NULL)
+	if (json_string_reserve(lex->str, len))
 	{
 		size_t read_len;
 		lex->str->len = len;
-		lex->str->str = temp;
 		read_len = fread(lex->str->str, sizeof(char), len, fp);
 		assert(read_len == len);
 		(void)read_len;
@@ -148,19 +147,74 @@ JSON_Token json_lexer_get_token(JSON_Lexer *lex)
 		return tok;
 	}
 
-	// Numbers
-	// FIXME: write this properly
-	if (isdigit(last) || last == '.')
+	// Numbers, as in RFC 8259: -?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)?
+	if (isdigit(last) || last == '-' || last == '.')
 	{
-		JSON_String *ident = json_string_new("");
-		do
+		uint32_t start = lex->offset - 1, end;
+		uint64_t magnitude = 0;
+		bool negative = false, integer = true;
+
+		if (last == '-')
 		{
-			json_string_append_char(ident, last);
+			negative = true;
 			last = json_lexer_getchar(lex);
 		}
-		while (isdigit(last) || last == '.');
-		json_string_assign_length(lex->value, ident->str, ident->len);
-		json_value_unref(ident);
+
+		// The integer part can't be left out, nor start with a zero
+		// unless it is one
+		if (!isdigit(last))
+			return JSON_TOKEN_ERROR;
+		else if (last == '0')
+		{
+			last = json_lexer_getchar(lex);
+			if (isdigit(last))
+				return JSON_TOKEN_ERROR;
+		}
+
+		// Accumulate the integer part as we go so that plain integers,
+		// by far the most common, never need to go through strtod()
+		for (; isdigit(last); last = json_lexer_getchar(lex))
+		{
+			unsigned int digit = last - '0';
+			if (magnitude > (UINT64_MAX - digit) / 10)
+				integer = false;
+			else
+				magnitude = magnitude * 10 + digit;
+		}
+
+		if (last == '.')
+		{
+			integer = false;
+			last = json_lexer_getchar(lex);
+			if (!isdigit(last))
+				return JSON_TOKEN_ERROR;
+			while (isdigit(last))
+				last = json_lexer_getchar(lex);
+		}
+
+		if (last == 'e' || last == 'E')
+		{
+			integer = false;
+			last = json_lexer_getchar(lex);
+			if (last == '+' || last == '-')
+				last = json_lexer_getchar(lex);
+			if (!isdigit(last))
+				return JSON_TOKEN_ERROR;
+			while (isdigit(last))
+				last = json_lexer_getchar(lex);
+		}
+
+		end = (last == JSON_LEXER_EOF) ? lex->offset : lex->offset - 1;
+		json_string_assign_length(lex->value, lex->str->str + start, end - start);
+
+		if (integer && !negative && magnitude <= INT64_MAX)
+			json_number_set_int64(&lex->number, (int64_t) magnitude);
+		else if (integer && negative && magnitude > 0 &&
+		         magnitude <= (uint64_t) INT64_MAX + 1)
+			json_number_set_int64(&lex->number, -(int64_t)(magnitude - 1) - 1);
+		else
+			json_number_set(&lex->number, strtod(json_string_cstr(lex->value), NULL));
+
 		return JSON_TOKEN_NUMBER;
 	}
 
@@ -3,6 +3,7 @@
 
 #include "value.h"
 #include "string.h"
+#include "number.h"
 #include "tokens.h"
 #include <stdio.h>
 
@@ -18,6 +19,7 @@ typedef struct
 	JSON_Value base__;
 	JSON_String *str;
 	JSON_String *value;
+	JSON_Number number;   // value of the last JSON_TOKEN_NUMBER
 	uint32_t offset;
 	uint32_t line;
 	uint32_t column;
@@ -5,7 +5,7 @@ int main()
 {
 	JSON_Object root;
 	JSON_Array arr;
-	JSON_String *str;
+	JSON_Sink sink;
 
 	json_object_init(&root);
 
@@ -22,12 +22,15 @@ int main()
 
 	json_object_set(&root, "c", &arr);
 	//json_object_debug_hash(&root);
-	str = json_value_to_string(&root, 0);
+	json_sink_init_file(&sink, stdout);
+	json_value_write(&root, &sink, 0);
+	json_sink_putc(&sink, '\n');
+	sink.flags = JSON_WRITE_FLAG_COMPACT;
+	json_value_write(&root, &sink, 0);
+	json_sink_putc(&sink, '\n');
+	json_sink_flush(&sink);
 	json_value_unref(&root);
 
-	json_print(json_string_cstr(str));
-	json_value_unref(str);
-
 #if 0
 #   define print_size(T) printf("Size of '" #T "': %lu\n", sizeof(T))
 	printf("==================================\n");
@@ -1,6 +1,6 @@
 #include "null.h"
 #include "util.h"
-#include "string.h"
+#include "sink.h"
 
 static JSON_Null json_null_;
 static bool json_initialized = false;
@@ -43,22 +43,15 @@ static bool json_null_equal(const JSON_Value *n1, const JSON_Value *n2)
 	return (null1 == null2);
 }
 
-static JSON_String *json_null_to_string(JSON_Value *n, int indent)
+static void json_null_write(JSON_Value *n, JSON_Sink *sink, int indent)
 {
-	JSON_String *str;
-	char *indent_str;
-
 #ifndef NDEBUG
 	assert(JSON_IS_NULL(n));
 #else
 	(void)n;
 #endif
-
-	indent_str = json_make_indent_string(indent);
-	str = json_string_new_printf("%snull", indent_str);
-	json_free(indent_str);
-
-	return str;
+	(void)indent;
+	json_sink_write(sink, "null", 4);
 }
 
 JSON_Null *json_null(void)
@@ -79,7 +72,7 @@ void *json_null_get_class(void)
 		NULL,
 		json_null_clone,
 		json_null_equal,
-		json_null_to_string,
+		json_null_write,
 	} };
 	return &json_null_class;
 }
@@ -1,46 +1,61 @@
 #include "number.h"
 #include "util.h"
-#include "string.h"
-#include <stdio.h>
+#include "sink.h"
+
+#define JSON_NUMBER_IS_INTEGER(num) \
+	(JSON_VALUE(num)->flags & JSON_VALUE_FLAG_INTEGER)
 
 static JSON_Value *json_number_clone(JSON_Value *value)
 {
 	JSON_Number *num;
 	assert(JSON_IS_NUMBER(value));
-	num = json_number_new(JSON_NUMBER(value)->value);
+	if (JSON_NUMBER_IS_INTEGER(value))
+		num = json_number_new_int64(JSON_NUMBER(value)->value.integer);
+	else
+		num = json_number_new(JSON_NUMBER(value)->value.real);
 	return JSON_VALUE(num);
 }
 
 static bool json_number_equal(const JSON_Value *v1, const JSON_Value *v2)
 {
 	JSON_Number *n1, *n2;
+	int64_t temp;
 	assert(JSON_IS_NUMBER(v1));
 	assert(JSON_IS_NUMBER(v2));
 	n1 = JSON_NUMBER(v1);
 	n2 = JSON_NUMBER(v2);
-	return (n1->value == n2->value);
+	if (JSON_LIKELY(JSON_NUMBER_IS_INTEGER(n1) && JSON_NUMBER_IS_INTEGER(n2)))
+		return (n1->value.integer == n2->value.integer);
+	else if (JSON_NUMBER_IS_INTEGER(n1))
+		return (json_double_to_int64(n2->value.real, &temp) && temp == n1->value.integer);
+	else if (JSON_NUMBER_IS_INTEGER(n2))
+		return (json_double_to_int64(n1->value.real, &temp) && temp == n2->value.integer);
+	return (n1->value.real == n2->value.real);
 }
 
-static JSON_String *json_number_to_string(JSON_Value *value, int indent)
+static void json_number_write(JSON_Value *value, JSON_Sink *sink, int indent)
 {
-	char *indent_str;
-	JSON_String *str;
-
 	assert(JSON_IS_NUMBER(value));
-
-	indent_str = json_make_indent_string(indent);
-	str = json_string_new_printf("%s%f", indent_str,
-		json_number_get(JSON_NUMBER(value)));
-	json_free(indent_str);
-
-	return str;
+	(void)indent;
+	if (JSON_NUMBER_IS_INTEGER(value))
+		json_sink_write_int64(sink, JSON_NUMBER(value)->value.integer);
+	else
+		json_sink_write_double(sink, JSON_NUMBER(value)->value.real);
 }
 
 JSON_Number *json_number_new(double val)
 {
 	JSON_Number *n = json_value_alloc(JSON_TYPE_NUMBER);
 	if (n)
-		n->value = val;
+		n->value.real = val;
+	return n;
+}
+
+JSON_Number *json_number_new_int64(int64_t val)
+{
+	JSON_Number *n = json_value_alloc(JSON_TYPE_NUMBER);
+	if (n)
+		json_number_set_int64(n, val);
 	return n;
 }
 
@@ -48,20 +63,56 @@ JSON_Number *json_number_init(JSON_Number *num)
 {
 	assert(num != NULL);
 	json_value_init(JSON_TYPE_NUMBER, JSON_VALUE(num));
-	num->value = 0.0;
+	num->value.real = 0.0;
 	return num;
 }
 
+bool json_number_is_integer(JSON_Number *num)
+{
+	assert(num);
+	return JSON_NUMBER_IS_INTEGER(num);
+}
+
 double json_number_get(JSON_Number *num)
 {
 	assert(num);
-	return num->value;
+	if (JSON_NUMBER_IS_INTEGER(num))
+		return (double) num->value.integer;
+	return num->value.real;
+}
+
+// Doubles are truncated towards zero and clamped to the int64_t range,
+// NaN reads as 0.
+int64_t json_number_get_int64(JSON_Number *num)
+{
+	double real;
+	assert(num);
+	if (JSON_LIKELY(JSON_NUMBER_IS_INTEGER(num)))
+		return num->value.integer;
+	real = num->value.real;
+	if (real != real)
+		return 0;
+	else if (real >= 9223372036854775807.0)
+		return INT64_MAX;
+	else if (real <= -9223372036854775808.0)
+		return INT64_MIN;
+	return (int64_t) real;
 }
 
 void json_number_set(JSON_Number *num, double value)
 {
 	assert(num);
-	num->value = value;
+	assert(!(JSON_VALUE(num)->flags & JSON_VALUE_FLAG_READONLY));
+	JSON_VALUE(num)->flags &= ~JSON_VALUE_FLAG_INTEGER;
+	num->value.real = value;
+}
+
+void json_number_set_int64(JSON_Number *num, int64_t value)
+{
+	assert(num);
+	assert(!(JSON_VALUE(num)->flags & JSON_VALUE_FLAG_READONLY));
+	JSON_VALUE(num)->flags |= JSON_VALUE_FLAG_INTEGER;
+	num->value.integer = value;
 }
 
 struct JSON_NumberClass
@@ -76,7 +127,7 @@ void *json_number_get_class(void)
 		NULL,
 		json_number_clone,
 		json_number_equal,
-		json_number_to_string,
+		json_number_write,
 	} };
 	return &json_number_class;
 }
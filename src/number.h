@@ -7,10 +7,17 @@
 extern "C" {
 #endif
 
+// Numbers are stored either as a double or, when flagged with
+// JSON_VALUE_FLAG_INTEGER, exactly as an int64_t.
 typedef struct
 {
 	JSON_Value base__;
-	double value;
+	union
+	{
+		double real;
+		int64_t integer;
+	}
+	value;
 }
 JSON_Number;
 
@@ -20,9 +27,13 @@ JSON_Number;
 
 void *json_number_get_class(void);
 JSON_Number *json_number_new(double value);
+JSON_Number *json_number_new_int64(int64_t value);
 JSON_Number *json_number_init(JSON_Number *num);
+bool json_number_is_integer(JSON_Number *num);
 double json_number_get(JSON_Number *num);
+int64_t json_number_get_int64(JSON_Number *num);
 void json_number_set(JSON_Number *num, double value);
+void json_number_set_int64(JSON_Number *num, int64_t value);
 
 #ifdef __cplusplus
 } // extern "C"
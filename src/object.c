@@ -1,69 +1,867 @@
 #include "object.h"
+#include "intern.h"
 #include "util.h"
 #include "string.h"
+#include "sink.h"
 
-#define JSON_OBJECT_INITIAL_NUM_BUCKETS 3
-#define JSON_OBJECT_GROW_FACTOR (1.0+(1.0/0.3))
-#define JSON_OBJECT_SHRINK_FACTOR (1.0/0.3)
-#define JSON_OBJECT_REHASH_MAX_LOAD_FACTOR 0.8
-#define JSON_OBJECT_REHASH_MIN_LOAD_FACTOR 0.2
+#ifdef JSON_HAVE_SSE2
+# include <emmintrin.h>
+#endif
 
-#define json_bucket_link_alloc() json_new(struct JSON_BucketLink)
+#define JSON_OBJECT_INITIAL_NUM_SLOTS 8
+#define JSON_OBJECT_INITIAL_NUM_ENTRIES 4
+#define JSON_OBJECT_SMALL_SIZE 8
+#define JSON_OBJECT_GROUP_WIDTH 16
+#define JSON_OBJECT_NOT_FOUND ((size_t)-1)
 
-static inline void json_bucket_link_free(struct JSON_BucketLink *link)
+// Incremental objects only resize gradually once this big, and move this
+// many old slots along on each modification while they do.
+#define JSON_OBJECT_INCREMENTAL_MIN_SLOTS 1024
+#define JSON_OBJECT_MIGRATE_SLOTS 32
+
+// Tables shrink once no more than 1 in this many slots is used
+#define JSON_OBJECT_SHRINK_THRESHOLD 16
+
+// Limits on the shared shape tree, objects going past them get a private
+// shape instead
+#define JSON_SHAPE_MAX_KEYS 32
+#define JSON_SHAPE_MAX_TRANSITIONS 64
+
+#define JSON_CTRL_EMPTY      ((uint8_t) 0x80)
+#define JSON_CTRL_DELETED    ((uint8_t) 0xFE)
+#define JSON_CTRL_IS_FULL(c) (((c) & 0x80) == 0)
+
+// The low bits of the hash pick where probing starts, the top 7 bits are
+// kept in the control byte to filter out most non-matching slots.
+#define json_object_h1(hash) ((size_t)(hash))
+#define json_object_h2(hash) ((uint8_t)((hash) >> 25))
+
+// At most 7/8 of the slots are used before the table grows
+#define json_object_max_elements(num_slots) ((num_slots) - (num_slots) / 8)
+
+#ifdef __GNUC__
+# define json_ctz(x) ((size_t) __builtin_ctz(x))
+# define json_ctz64(x) ((size_t) __builtin_ctzll(x))
+# define json_clz16(x) ((size_t) __builtin_clz(x) - 16)
+#else
+static inline size_t json_ctz64(uint64_t x)
+{
+	size_t n = 0;
+	while (!(x & 1))
+	{
+		x >>= 1;
+		n++;
+	}
+	return n;
+}
+static inline size_t json_ctz(uint32_t x)
+{
+	size_t n = 0;
+	while (!(x & 1))
+	{
+		x >>= 1;
+		n++;
+	}
+	return n;
+}
+static inline size_t json_clz16(uint32_t x)
+{
+	size_t n = 0;
+	while (!(x & 0x8000))
+	{
+		x <<= 1;
+		n++;
+	}
+	return n;
+}
+#endif
+
+// Each returns a bitmask with bit `i` set if control byte `i` of the
+// group starting at `group` matches.
+
+#ifdef JSON_HAVE_SSE2
+
+static inline uint32_t json_group_match(const uint8_t *group, uint8_t h2)
 {
-	assert(link != NULL);
-	json_free(link->key);
-	json_value_unref(link->value);
-	json_free(link);
+	__m128i ctrl = _mm_loadu_si128((const __m128i*) group);
+	return (uint32_t) _mm_movemask_epi8(
+		_mm_cmpeq_epi8(ctrl, _mm_set1_epi8((char) h2)));
 }
 
-static void json_object_free(JSON_Value *value)
+static inline uint32_t json_group_match_empty_or_deleted(const uint8_t *group)
 {
+	// Only empty and deleted have the high bit set
+	return (uint32_t) _mm_movemask_epi8(_mm_loadu_si128((const __m128i*) group));
+}
+
+#else
+
+static inline uint32_t json_group_match(const uint8_t *group, uint8_t h2)
+{
+	uint32_t mask = 0;
 	size_t i;
-	JSON_Object *obj = JSON_OBJECT(value);
+	for (i = 0; i < JSON_OBJECT_GROUP_WIDTH; i++)
+		mask |= (uint32_t)(group[i] == h2) << i;
+	return mask;
+}
 
-	assert(JSON_IS_OBJECT(value));
+static inline uint32_t json_group_match_empty_or_deleted(const uint8_t *group)
+{
+	uint32_t mask = 0;
+	size_t i;
+	for (i = 0; i < JSON_OBJECT_GROUP_WIDTH; i++)
+		mask |= (uint32_t)(!JSON_CTRL_IS_FULL(group[i])) << i;
+	return mask;
+}
+
+#endif // JSON_HAVE_SSE2
+
+#define json_group_match_empty(group) json_group_match(group, JSON_CTRL_EMPTY)
+
+// Shapes with up to 8 keys keep one tag byte per key in a single word
+// instead of an index: the same top 7 bits of the hash, or empty for
+// holes. This returns a mask with the high bit of byte `i` set if tag `i`
+// is `h2`, possibly with a few false positives, which the caller's key
+// comparison weeds out anyway.
+static inline uint64_t json_tags_match(uint64_t tags, uint8_t h2)
+{
+	uint64_t x = tags ^ (0x0101010101010101ULL * h2);
+	return (x - 0x0101010101010101ULL) & ~x & 0x8080808080808080ULL;
+}
+
+static inline void json_shape_set_tag(JSON_Shape *shape, size_t n, uint8_t tag)
+{
+	assert(n < JSON_OBJECT_SMALL_SIZE);
+	shape->tags &= ~((uint64_t) 0xFF << (n * 8));
+	shape->tags |= (uint64_t) tag << (n * 8);
+}
+
+#define json_object_key_is_hole(k) ((k)->key == NULL)
+#define json_shape_is_shared(shape) ((shape)->id != 0)
+
+// Keys are interned, so the same pointer and length means the same key; a
+// caller's key can be a prefix of an interned one. Otherwise `key` might
+// not be interned and the bytes have to be compared.
+static inline bool json_object_key_equal(const struct JSON_ObjectKey *k,
+	const JSON_Key *key)
+{
+	if (k->key == key->str && k->len == key->len)
+		return true;
+	return (k->hash == key->hash && k->len == key->len &&
+		memcmp(k->key, key->str, key->len) == 0);
+}
+
+// The control bytes are followed by a copy of the first group's worth so
+// that a group can be loaded at any slot without wrapping around. Tables
+// smaller than a group repeat their control bytes to fill it.
+static inline void json_object_set_ctrl(struct JSON_ObjectIndex *ix, size_t i, uint8_t c)
+{
+	size_t j;
+	ix->ctrl[i] = c;
+	for (j = i + ix->num_slots; j < ix->num_slots + JSON_OBJECT_GROUP_WIDTH;
+	     j += ix->num_slots)
+	{
+		ix->ctrl[j] = c;
+	}
+}
+
+// Slots and control bytes share a single allocation
+static void json_object_index_alloc(struct JSON_ObjectIndex *ix, size_t num_slots)
+{
+	assert(num_slots > 0 && (num_slots & (num_slots - 1)) == 0);
+	ix->slots = json_malloc(num_slots * sizeof(uint32_t) +
+		num_slots + JSON_OBJECT_GROUP_WIDTH);
+	ix->ctrl = (uint8_t*)(ix->slots + num_slots);
+	memset(ix->ctrl, JSON_CTRL_EMPTY, num_slots + JSON_OBJECT_GROUP_WIDTH);
+	ix->num_slots = num_slots;
+	ix->growth_left = json_object_max_elements(num_slots);
+}
+
+static void json_object_index_free(struct JSON_ObjectIndex *ix)
+{
+	if (ix->slots != NULL)
+		json_free(ix->slots);
+	memset(ix, 0, sizeof(struct JSON_ObjectIndex));
+}
+
+// Position of the slot in `ix` which refers to the key `key`
+static size_t json_object_find(JSON_Shape *shape, struct JSON_ObjectIndex *ix,
+	const JSON_Key *key)
+{
+	size_t mask, offset, stride = 0;
+	uint8_t h2 = json_object_h2(key->hash);
+
+	if (JSON_UNLIKELY(ix->num_slots == 0))
+		return JSON_OBJECT_NOT_FOUND;
+
+	mask = ix->num_slots - 1;
+	offset = json_object_h1(key->hash) & mask;
+
+	while (true)
+	{
+		const uint8_t *group = ix->ctrl + offset;
+		uint32_t match = json_group_match(group, h2);
+
+		while (match)
+		{
+			size_t i = (offset + json_ctz(match)) & mask;
+			if (json_object_key_equal(&shape->keys[ix->slots[i]], key))
+				return i;
+			match &= match - 1;
+		}
+
+		// A probe never continues past a group with an empty slot
+		if (JSON_LIKELY(json_group_match_empty(group)))
+			return JSON_OBJECT_NOT_FOUND;
+
+		stride += JSON_OBJECT_GROUP_WIDTH;
+		offset = (offset + stride) & mask;
+	}
+}
+
+// Position of `key` in a shape without an index
+static size_t json_object_find_small(JSON_Shape *shape, const JSON_Key *key)
+{
+	uint64_t match = json_tags_match(shape->tags, json_object_h2(key->hash));
+
+	// Ignore the tags past the last key
+	if (shape->num_keys < JSON_OBJECT_SMALL_SIZE)
+		match &= ((uint64_t) 1 << (shape->num_keys * 8)) - 1;
+
+	while (match)
+	{
+		size_t n = json_ctz64(match) / 8;
+		if (json_object_key_equal(&shape->keys[n], key))
+			return n;
+		match &= match - 1;
+	}
+
+	return JSON_OBJECT_NOT_FOUND;
+}
+
+// First empty or deleted slot along the probe sequence for `hash`
+static size_t json_object_find_free_slot(struct JSON_ObjectIndex *ix, uint32_t hash)
+{
+	size_t mask, offset, stride = 0;
+
+	assert(ix->num_slots > 0);
+
+	mask = ix->num_slots - 1;
+	offset = json_object_h1(hash) & mask;
+
+	while (true)
+	{
+		uint32_t match = json_group_match_empty_or_deleted(ix->ctrl + offset);
+		if (JSON_LIKELY(match))
+			return (offset + json_ctz(match)) & mask;
+		stride += JSON_OBJECT_GROUP_WIDTH;
+		offset = (offset + stride) & mask;
+	}
+}
+
+// Index key `n`, known not to be in the table yet. Reusing a deleted
+// slot doesn't use up any room.
+static void json_object_insert_slot(struct JSON_ObjectIndex *ix, uint32_t hash,
+	uint32_t n)
+{
+	size_t i = json_object_find_free_slot(ix, hash);
+	if (ix->ctrl[i] == JSON_CTRL_EMPTY)
+	{
+		assert(ix->growth_left > 0);
+		ix->growth_left--;
+	}
+	json_object_set_ctrl(ix, i, json_object_h2(hash));
+	ix->slots[i] = n;
+}
+
+// Whether slot `i` could be marked empty rather than deleted, ie. no
+// probe sequence has ever passed over it while looking for something else.
+static bool json_object_slot_was_never_full(struct JSON_ObjectIndex *ix, size_t i)
+{
+	size_t mask = ix->num_slots - 1;
+	uint32_t empty_before, empty_after;
+
+	// Every probe sees the whole table in its first group
+	if (ix->num_slots < JSON_OBJECT_GROUP_WIDTH)
+		return true;
+
+	empty_before = json_group_match_empty(
+		ix->ctrl + ((i - JSON_OBJECT_GROUP_WIDTH) & mask));
+	empty_after = json_group_match_empty(ix->ctrl + i);
+
+	return (empty_before && empty_after &&
+		json_ctz(empty_after) + json_clz16(empty_before) < JSON_OBJECT_GROUP_WIDTH);
+}
+
+static void json_object_erase_slot(struct JSON_ObjectIndex *ix, size_t i)
+{
+	if (json_object_slot_was_never_full(ix, i))
+	{
+		json_object_set_ctrl(ix, i, JSON_CTRL_EMPTY);
+		ix->growth_left++;
+	}
+	else
+		json_object_set_ctrl(ix, i, JSON_CTRL_DELETED);
+}
+
+// A private shape being resized incrementally keeps its previous index
+// here and moves a few slots of it into the new one on every
+// modification, so that growing a huge object never stalls on
+// re-indexing everything at once. Lookups check both until it's done.
+struct JSON_ObjectRehash
+{
+	struct JSON_ObjectIndex old;
+	size_t pos;
+};
+
+#define json_object_is_incremental(obj) \
+	((JSON_VALUE(obj)->flags & JSON_VALUE_FLAG_INCREMENTAL) && \
+	 (obj)->shape__->index.num_slots >= JSON_OBJECT_INCREMENTAL_MIN_SLOTS)
+
+static void json_object_drop_rehash(JSON_Shape *shape)
+{
+	if (shape->rehash != NULL)
+	{
+		json_object_index_free(&shape->rehash->old);
+		json_free(shape->rehash);
+		shape->rehash = NULL;
+	}
+}
+
+// Move up to `n` slots' worth of keys from the old index
+static void json_object_migrate(JSON_Shape *shape, size_t n)
+{
+	struct JSON_ObjectRehash *rehash = shape->rehash;
+	struct JSON_ObjectIndex *old;
+
+	if (JSON_LIKELY(rehash == NULL))
+		return;
+
+	old = &rehash->old;
+	for (; n > 0 && rehash->pos < old->num_slots; n--, rehash->pos++)
+	{
+		size_t i = rehash->pos;
+		if (JSON_CTRL_IS_FULL(old->ctrl[i]))
+		{
+			uint32_t k = old->slots[i];
+			// Marked deleted so probes for keys further along still get there
+			json_object_insert_slot(&shape->index, shape->keys[k].hash, k);
+			json_object_set_ctrl(old, i, JSON_CTRL_DELETED);
+		}
+	}
+
+	if (rehash->pos == old->num_slots)
+		json_object_drop_rehash(shape);
+}
+
+// Index all keys afresh in a table with `num_slots` slots, or in the tag
+// word if it's 0. This is a sequential pass over the keys using their
+// cached hashes, keys are never copied or rehashed.
+static void json_object_reindex(JSON_Shape *shape, size_t num_slots)
+{
+	size_t i;
+
+	json_object_drop_rehash(shape);
+	json_object_index_free(&shape->index);
+
+	if (num_slots == 0)
+	{
+		assert(shape->num_keys <= JSON_OBJECT_SMALL_SIZE);
+		shape->tags = 0;
+		for (i = 0; i < shape->num_keys; i++)
+		{
+			if (json_object_key_is_hole(&shape->keys[i]))
+				json_shape_set_tag(shape, i, JSON_CTRL_EMPTY);
+			else
+				json_shape_set_tag(shape, i, json_object_h2(shape->keys[i].hash));
+		}
+		return;
+	}
+
+	json_object_index_alloc(&shape->index, num_slots);
+
+	for (i = 0; i < shape->num_keys; i++)
+	{
+		if (!json_object_key_is_hole(&shape->keys[i]))
+			json_object_insert_slot(&shape->index, shape->keys[i].hash, (uint32_t) i);
+	}
+}
+
+// Like json_object_reindex() but moves the keys over gradually if the
+// object allows it and is big enough for it to matter.
+static void json_object_start_resize(JSON_Object *obj, size_t num_slots)
+{
+	JSON_Shape *shape = obj->shape__;
+	struct JSON_ObjectRehash *rehash;
+
+	if (!json_object_is_incremental(obj) || shape->rehash != NULL)
+	{
+		json_object_reindex(shape, num_slots);
+		return;
+	}
+
+	rehash = json_new(struct JSON_ObjectRehash);
+	rehash->old = shape->index;
+	rehash->pos = 0;
+
+	json_object_index_alloc(&shape->index, num_slots);
+	shape->rehash = rehash;
+}
+
+// Smallest index that holds `num_elements` at most half full
+static size_t json_object_ideal_num_slots(size_t num_elements)
+{
+	size_t num_slots = JSON_OBJECT_INITIAL_NUM_SLOTS;
+	while (json_object_max_elements(num_slots) < num_elements * 2)
+		num_slots *= 2;
+	return num_slots;
+}
+
+// Index size for a settled shape with `num_elements`, 0 for none
+static size_t json_object_settled_num_slots(size_t num_elements)
+{
+	if (num_elements <= JSON_OBJECT_SMALL_SIZE)
+		return 0;
+	return json_object_ideal_num_slots(num_elements);
+}
+
+// Smallest keys and values arrays that hold `num_elements`
+static size_t json_object_ideal_num_entries(size_t num_elements)
+{
+	size_t reserved = JSON_OBJECT_INITIAL_NUM_ENTRIES;
+	while (reserved < num_elements)
+		reserved *= 2;
+	return reserved;
+}
+
+// Called when an insert would use up the last free index slot. Indexes
+// that are mostly tombstones are cleaned up, others double.
+static void json_object_grow(JSON_Object *obj)
+{
+	JSON_Shape *shape = obj->shape__;
+	size_t num_slots = shape->index.num_slots;
+
+	assert(num_slots > 0);
+
+	if (shape->rehash != NULL)
+	{
+		// Still moving the last resize's keys over, finish that first
+		json_object_migrate(shape, SIZE_MAX);
+		if (shape->index.growth_left == 0)
+			json_object_grow(obj);
+	}
+	else if (obj->num_elements * 2 <= json_object_max_elements(num_slots))
+		json_object_start_resize(obj, num_slots);
+	else
+		json_object_start_resize(obj, num_slots * 2);
+}
+
+// Private shapes forget their sorted order whenever their keys change
+static void json_shape_drop_order(JSON_Shape *shape)
+{
+	if (shape->order != NULL)
+	{
+		json_free(shape->order);
+		shape->order = NULL;
+	}
+}
+
+// Resize the keys of a private shape and the values along with them
+static void json_object_realloc_entries(JSON_Object *obj, size_t reserved)
+{
+	JSON_Shape *shape = obj->shape__;
+
+	assert(!json_shape_is_shared(shape));
+	assert(reserved >= shape->num_keys);
+
+	shape->keys = json_realloc(shape->keys, reserved * sizeof(struct JSON_ObjectKey));
+	obj->values = json_realloc(obj->values, reserved * sizeof(JSON_Value*));
+	shape->reserved = reserved;
+	obj->reserved__ = reserved;
+}
+
+// Squeeze the holes out of a private shape and the values and give them
+// room for `reserved` members. Positions change, so the index is rebuilt
+// with `num_slots`.
+static void json_object_compact(JSON_Object *obj, size_t reserved, size_t num_slots)
+{
+	JSON_Shape *shape = obj->shape__;
+	size_t i, n = 0;
+
+	for (i = 0; i < shape->num_keys; i++)
+	{
+		if (!json_object_key_is_hole(&shape->keys[i]))
+		{
+			shape->keys[n] = shape->keys[i];
+			obj->values[n] = obj->values[i];
+			n++;
+		}
+	}
+
+	assert(n == obj->num_elements);
+	shape->num_keys = n;
+	json_shape_drop_order(shape);
+
+	if (reserved != shape->reserved)
+		json_object_realloc_entries(obj, reserved);
+
+	json_object_reindex(shape, num_slots);
+}
+
+// Make room to append to a private shape, re-using the space of deleted
+// members if they make up half of it
+static void json_object_reserve_entry(JSON_Object *obj)
+{
+	JSON_Shape *shape = obj->shape__;
+	size_t reserved = shape->reserved;
+
+	assert(reserved == obj->reserved__);
+
+	if (JSON_LIKELY(shape->num_keys < reserved))
+		return;
+
+	assert(reserved < UINT32_MAX);
+
+	if (reserved > 0 && (shape->num_keys - obj->num_elements) * 2 >= reserved)
+		json_object_compact(obj, reserved, shape->index.num_slots);
+	else
+		json_object_realloc_entries(obj, reserved ? (reserved * 2) : JSON_OBJECT_INITIAL_NUM_ENTRIES);
+}
+
+// Called after removing a member from a private shape, hands memory back
+// once the index is mostly empty.
+static void json_object_shrink(JSON_Object *obj)
+{
+	JSON_Shape *shape = obj->shape__;
+
+	if (shape->rehash != NULL ||
+	    shape->index.num_slots <= JSON_OBJECT_INITIAL_NUM_SLOTS ||
+	    obj->num_elements * JSON_OBJECT_SHRINK_THRESHOLD > shape->index.num_slots)
+	{
+		return;
+	}
+
+	// Compacting renumbers the keys, which needs a full re-index, so
+	// incremental objects leave that to the next append that runs out
+	// of room
+	if (json_object_is_incremental(obj))
+		json_object_start_resize(obj, json_object_ideal_num_slots(obj->num_elements));
+	else
+	{
+		json_object_compact(obj, json_object_ideal_num_entries(obj->num_elements),
+			json_object_settled_num_slots(obj->num_elements));
+	}
+}
+
+// Position of `key` in the shape, through either index or the tags
+static size_t json_object_lookup(JSON_Shape *shape, const JSON_Key *key)
+{
+	size_t i;
+
+	if (shape->index.num_slots == 0)
+		return json_object_find_small(shape, key);
+
+	i = json_object_find(shape, &shape->index, key);
+	if (JSON_LIKELY(i != JSON_OBJECT_NOT_FOUND))
+		return shape->index.slots[i];
+	else if (shape->rehash != NULL)
+	{
+		i = json_object_find(shape, &shape->rehash->old, key);
+		if (i != JSON_OBJECT_NOT_FOUND)
+			return shape->rehash->old.slots[i];
+	}
+	return JSON_OBJECT_NOT_FOUND;
+}
+
+// The empty shape that every object starts out with
+static JSON_Shape json_shape_root = {
+	1, 1, NULL, NULL, 0, 0, { NULL, NULL, 0, 0 }, 0, NULL, NULL, 0, NULL
+};
+
+static uint64_t json_shape_next_id = 2;
+
+// Guards the shared shape tree and reference counts
+static JSON_Mutex json_shape_lock = JSON_MUTEX_INIT;
+
+static JSON_Shape *json_shape_ref(JSON_Shape *shape)
+{
+	assert(json_shape_is_shared(shape));
+	json_mutex_lock(&json_shape_lock);
+	shape->refcount++;
+	json_mutex_unlock(&json_shape_lock);
+	return shape;
+}
+
+static void json_shape_free(JSON_Shape *shape)
+{
+	json_shape_drop_order(shape);
+	if (shape->keys != NULL)
+		json_free(shape->keys);
+	json_object_index_free(&shape->index);
+	json_object_drop_rehash(shape);
+	json_free(shape);
+}
+
+static void json_shape_unref(JSON_Shape *shape)
+{
+	JSON_Shape *parent;
+	size_t i;
+
+	// Private shapes only ever have their one object
+	if (!json_shape_is_shared(shape))
+	{
+		assert(shape->refcount == 1);
+		for (i = 0; i < shape->num_keys; i++)
+		{
+			if (!json_object_key_is_hole(&shape->keys[i]))
+				json_intern_unref(shape->keys[i].key);
+		}
+		json_shape_free(shape);
+		return;
+	}
+
+	json_mutex_lock(&json_shape_lock);
+
+	for (; shape != NULL; shape = parent)
+	{
+		assert(shape->refcount > 0);
+		if (--shape->refcount > 0)
+			break;
+
+		assert(shape != &json_shape_root);
+		assert(shape->num_transitions == 0);
+		parent = shape->parent;
+
+		// Only the last key is this shape's own, the others are borrowed
+		// from its ancestors
+		json_intern_unref(shape->keys[shape->num_keys - 1].key);
+
+		for (i = 0; i < parent->num_transitions; i++)
+		{
+			if (parent->transitions[i] == shape)
+			{
+				parent->transitions[i] = parent->transitions[--parent->num_transitions];
+				break;
+			}
+		}
+		if (parent->num_transitions == 0)
+		{
+			json_free(parent->transitions);
+			parent->transitions = NULL;
+		}
+
+		json_shape_free(shape);
+	}
+
+	json_mutex_unlock(&json_shape_lock);
+}
+
+// The shared shape with `key` added to the end of `shape`, a new
+// reference, or NULL if that would go past the limits of the tree
+static JSON_Shape *json_shape_add_key(JSON_Shape *shape, const JSON_Key *key)
+{
+	JSON_Shape *child;
+	size_t i;
+
+	assert(json_shape_is_shared(shape));
+
+	json_mutex_lock(&json_shape_lock);
+
+	for (i = 0; i < shape->num_transitions; i++)
+	{
+		child = shape->transitions[i];
+		if (json_object_key_equal(&child->keys[child->num_keys - 1], key))
+		{
+			child->refcount++;
+			json_mutex_unlock(&json_shape_lock);
+			return child;
+		}
+	}
+
+	if (shape->num_keys >= JSON_SHAPE_MAX_KEYS ||
+	    shape->num_transitions >= JSON_SHAPE_MAX_TRANSITIONS)
+	{
+		json_mutex_unlock(&json_shape_lock);
+		return NULL;
+	}
+
+	child = json_new(JSON_Shape);
+	child->refcount = 1;
+	child->id = json_shape_next_id++;
+	child->parent = shape;
+	shape->refcount++;
+	child->num_keys = shape->num_keys + 1;
+	child->reserved = child->num_keys;
+	child->keys = json_malloc(child->num_keys * sizeof(struct JSON_ObjectKey));
+	if (shape->num_keys > 0)
+		memcpy(child->keys, shape->keys, shape->num_keys * sizeof(struct JSON_ObjectKey));
+	child->keys[shape->num_keys].hash = key->hash;
+	child->keys[shape->num_keys].len = (uint32_t) key->len;
+	child->keys[shape->num_keys].key = json_intern(key->str, key->len, key->hash);
+	json_object_reindex(child, json_object_settled_num_slots(child->num_keys));
+
+	// The parent doesn't hold a reference, children remove themselves
+	shape->transitions = json_realloc(shape->transitions,
+		(shape->num_transitions + 1) * sizeof(JSON_Shape*));
+	shape->transitions[shape->num_transitions++] = child;
+
+	json_mutex_unlock(&json_shape_lock);
 
-	for (i = 0; i < obj->num_buckets; i++)
+	return child;
+}
+
+// Give `obj` a shape of its own that it can change freely
+static void json_object_make_private(JSON_Object *obj)
+{
+	JSON_Shape *shape = obj->shape__, *own;
+	size_t i;
+
+	if (!json_shape_is_shared(shape))
+		return;
+
+	own = json_new(JSON_Shape);
+	own->refcount = 1;
+	own->num_keys = shape->num_keys;
+	own->reserved = obj->reserved__;
+	if (own->reserved > 0)
 	{
-		struct JSON_BucketLink *link = obj->buckets[i];
-		while (link != NULL)
+		own->keys = json_malloc(own->reserved * sizeof(struct JSON_ObjectKey));
+		for (i = 0; i < shape->num_keys; i++)
 		{
-			struct JSON_BucketLink *next = link->next;
-			json_bucket_link_free(link);
-			link = next;
+			own->keys[i] = shape->keys[i];
+			own->keys[i].key = json_intern_ref(shape->keys[i].key);
 		}
 	}
+	json_object_reindex(own, json_object_settled_num_slots(own->num_keys));
+
+	json_shape_unref(shape);
+	obj->shape__ = own;
+}
+
+void json_object_iter_init(JSON_ObjectIter *iter, JSON_Object *obj)
+{
+	assert(iter != NULL);
+	assert(JSON_IS_OBJECT(obj));
+	iter->key.str = NULL;
+	iter->key.len = 0;
+	iter->key.hash = 0;
+	iter->value = NULL;
+	iter->obj__ = obj;
+	iter->pos__ = 0;
+}
+
+bool json_object_iter_next(JSON_ObjectIter *iter)
+{
+	JSON_Object *obj = iter->obj__;
+	JSON_Shape *shape = obj->shape__;
+	size_t i;
+
+	for (i = iter->pos__; i < shape->num_keys; i++)
+	{
+		struct JSON_ObjectKey *key = &shape->keys[i];
+		if (json_object_key_is_hole(key))
+			continue;
+		if (i + 1 < shape->num_keys)
+			JSON_PREFETCH(obj->values[i + 1]);
+		iter->key.str = key->key;
+		iter->key.len = key->len;
+		iter->key.hash = key->hash;
+		iter->value = obj->values[i];
+		iter->pos__ = i + 1;
+		return true;
+	}
+
+	iter->pos__ = shape->num_keys;
+	return false;
+}
+
+static void json_object_free(JSON_Value *value)
+{
+	JSON_Object *obj = JSON_OBJECT(value);
+	JSON_ObjectIter iter;
+
+	assert(JSON_IS_OBJECT(value));
+
+	json_cache_free__(&obj->link__);
+
+	json_object_iter_init(&iter, obj);
+	while (json_object_iter_next(&iter))
+	{
+		json_cache_release__(value, iter.value);
+		json_value_unref(iter.value);
+	}
+
+	if (obj->values != NULL)
+		json_free(obj->values);
 
-	json_free(obj->buckets);
+	json_shape_unref(obj->shape__);
 }
 
 static JSON_Value *json_object_clone(JSON_Value *value)
 {
 	JSON_Object *obj = JSON_OBJECT(value);
+	JSON_Shape *shape = obj->shape__, *own;
 	JSON_Object *new_obj;
-	size_t i;
+	JSON_ObjectIter iter;
+	size_t i, n = 0;
 
 	assert(JSON_IS_OBJECT(value));
 
 	new_obj = json_object_new();
+	if (new_obj == NULL || obj->num_elements == 0)
+		return JSON_VALUE(new_obj);
 
-	for (i = 0; i < obj->num_buckets; i++)
+	// Same keys, so the same shape
+	if (json_shape_is_shared(shape))
 	{
-		struct JSON_BucketLink *link;
-		for (link = obj->buckets[i]; link != NULL; link = link->next)
-			json_object_set(new_obj, link->key, json_value_clone(link->value));
+		json_shape_unref(new_obj->shape__);
+		new_obj->shape__ = json_shape_ref(shape);
+		new_obj->reserved__ = shape->num_keys;
+		new_obj->values = json_malloc(shape->num_keys * sizeof(JSON_Value*));
+		for (i = 0; i < shape->num_keys; i++)
+		{
+			new_obj->values[i] = json_value_ref_sink(json_value_clone(obj->values[i]));
+			json_cache_adopt__(JSON_VALUE(new_obj), new_obj->values[i]);
+		}
+		new_obj->num_elements = obj->num_elements;
+		return JSON_VALUE(new_obj);
 	}
 
+	own = json_new(JSON_Shape);
+	own->refcount = 1;
+	own->reserved = json_object_ideal_num_entries(obj->num_elements);
+	own->keys = json_malloc(own->reserved * sizeof(struct JSON_ObjectKey));
+	new_obj->reserved__ = own->reserved;
+	new_obj->values = json_malloc(own->reserved * sizeof(JSON_Value*));
+
+	json_object_iter_init(&iter, obj);
+	while (json_object_iter_next(&iter))
+	{
+		own->keys[n].hash = iter.key.hash;
+		own->keys[n].len = iter.key.len;
+		own->keys[n].key = json_intern_ref(iter.key.str);
+		new_obj->values[n] = json_value_ref_sink(json_value_clone(iter.value));
+		json_cache_adopt__(JSON_VALUE(new_obj), new_obj->values[n]);
+		n++;
+	}
+
+	own->num_keys = n;
+	json_object_reindex(own, json_object_settled_num_slots(n));
+
+	json_shape_unref(new_obj->shape__);
+	new_obj->shape__ = own;
+	new_obj->num_elements = n;
+
 	return JSON_VALUE(new_obj);
 }
 
 static bool json_object_equal(const JSON_Value *val1, const JSON_Value *val2)
 {
-	size_t i;
 	JSON_Object *obj1 = JSON_OBJECT(val1);
 	JSON_Object *obj2 = JSON_OBJECT(val2);
+	JSON_Shape *shape1, *shape2;
+	JSON_ObjectIter iter;
+	size_t i;
 
 	assert(JSON_IS_OBJECT(val1));
 	assert(JSON_IS_OBJECT(val2));
@@ -71,80 +869,217 @@ static bool json_object_equal(const JSON_Value *val1, const JSON_Value *val2)
 	if (obj1->num_elements != obj2->num_elements)
 		return false;
 
-	for (i = 0; i < obj1->num_buckets; i++)
+	shape1 = obj1->shape__;
+	shape2 = obj2->shape__;
+
+	// Same shape, same keys in the same places
+	if (shape1 == shape2)
 	{
-		struct JSON_BucketLink *link;
-		for (link = obj1->buckets[i]; link != NULL; link = link->next)
+		for (i = 0; i < shape1->num_keys; i++)
 		{
-			JSON_Value *value = json_object_get(obj2, link->key);
-			if (value == NULL)
-				return false;
-			else if (!json_value_equal(link->value, value))
+			if (!json_value_equal(obj1->values[i], obj2->values[i]))
 				return false;
 		}
+		return true;
+	}
+
+	json_object_iter_init(&iter, obj1);
+	while (json_object_iter_next(&iter))
+	{
+		i = json_object_lookup(shape2, &iter.key);
+		if (i == JSON_OBJECT_NOT_FOUND)
+			return false;
+		else if (!json_value_equal(iter.value, obj2->values[i]))
+			return false;
 	}
 
 	return true;
 }
 
-static JSON_String *json_object_to_string(JSON_Value *value, int indent)
+// The character at the start of `s` as a number that orders the way its
+// UTF-16 code units do. Past U+FFFF, characters are surrogate pairs there
+// and go before U+E000 to U+FFFF rather than after them.
+static uint32_t json_canonical_char(const char *s, size_t len)
 {
-	JSON_Object *obj = JSON_OBJECT(value);
-	JSON_String *str;
-	char *indent_str;
-	size_t i;
+	const uint8_t *u = (const uint8_t*) s;
+	uint32_t c;
 
-	assert(JSON_IS_OBJECT(value));
+	if (u[0] >= 0xF0 && len >= 4)
+	{
+		c = ((uint32_t)(u[0] & 0x07) << 18) | ((uint32_t)(u[1] & 0x3F) << 12) |
+			((uint32_t)(u[2] & 0x3F) << 6) | (u[3] & 0x3F);
+		if (c >= 0x10000)
+		{
+			c -= 0x10000;
+			return ((0xD800 + (c >> 10)) << 10) | (c & 0x3FF);
+		}
+	}
+	else if (u[0] >= 0xE0 && len >= 3)
+		c = ((uint32_t)(u[0] & 0x0F) << 12) | ((uint32_t)(u[1] & 0x3F) << 6) | (u[2] & 0x3F);
+	else if (u[0] >= 0xC0 && len >= 2)
+		c = ((uint32_t)(u[0] & 0x1F) << 6) | (u[1] & 0x3F);
+	else
+		c = u[0];
+
+	return c << 10;
+}
 
-	indent_str = json_make_indent_string(indent);
-	str = json_string_new_printf("%s{\n", indent_str);
-	json_free(indent_str);
+// Orders keys as RFC 8785 does, by their UTF-16 code units. UTF-8 bytes
+// already sort by code point, so only the first character that differs
+// needs decoding.
+static int json_canonical_compare(const void *a, const void *b)
+{
+	const struct JSON_ObjectKey *k1 = *(const struct JSON_ObjectKey* const*) a;
+	const struct JSON_ObjectKey *k2 = *(const struct JSON_ObjectKey* const*) b;
+	size_t n = (k1->len < k2->len) ? k1->len : k2->len, i;
+	uint32_t c1, c2;
+
+	for (i = 0; i < n && k1->key[i] == k2->key[i]; i++)
+		;
 
-	indent++;
-	indent_str = json_make_indent_string(indent);
+	if (i == n)
+		return (k1->len > k2->len) - (k1->len < k2->len);
 
-	for (i = 0; i < obj->num_buckets; i++)
+	// Back to the start of the character, which both keys share
+	while (i > 0 && ((uint8_t) k1->key[i] & 0xC0) == 0x80)
+		i--;
+
+	c1 = json_canonical_char(k1->key + i, k1->len - i);
+	c2 = json_canonical_char(k2->key + i, k2->len - i);
+	return (c1 > c2) - (c1 < c2);
+}
+
+// The slots of the members of `obj` in canonical order. It's kept with the
+// shape, so objects of a shared shape are sorted once between them and an
+// object is only sorted again after its keys change.
+static const uint32_t *json_object_canonical_order(JSON_Object *obj)
+{
+	JSON_Shape *shape = obj->shape__;
+	const struct JSON_ObjectKey **keys;
+	uint32_t *order;
+	size_t i, n = 0;
+
+	// Shared shapes are used from any thread. The order never changes once
+	// it's there, so only building it takes the lock.
+	order = json_load_acquire(&shape->order);
+	if (JSON_LIKELY(order != NULL))
+		return order;
+
+	json_mutex_lock(&json_shape_lock);
+
+	order = shape->order;
+	if (order == NULL)
 	{
-		struct JSON_BucketLink *link;
-		for (link = obj->buckets[i]; link != NULL; link = link->next)
+		keys = json_malloc(obj->num_elements * sizeof(*keys));
+		for (i = 0; i < shape->num_keys; i++)
 		{
-			JSON_String *value_str = json_value_to_string(link->value, indent);
-			assert(JSON_IS_STRING(value_str));
-			json_string_lstrip(value_str);
-			json_string_prepend_printf(value_str, "%s\"%s\": ", indent_str,
-				link->key);
-			json_string_append(str, value_str);
-			json_value_unref(value_str);
-			// FIXME: this doesn't work
-			if (i == (obj->num_buckets - 1) && link->next == NULL)
-				json_string_append_char(str, '\n');
-			else
-				json_string_append_cstr(str, ",\n");
+			if (!json_object_key_is_hole(&shape->keys[i]))
+				keys[n++] = &shape->keys[i];
 		}
+		assert(n == obj->num_elements);
+
+		qsort(keys, n, sizeof(*keys), json_canonical_compare);
+
+		order = json_malloc(n * sizeof(uint32_t));
+		for (i = 0; i < n; i++)
+			order[i] = (uint32_t)(keys[i] - shape->keys);
+		json_free(keys);
+		json_store_release(&shape->order, order);
 	}
 
-	json_free(indent_str);
-	indent--;
+	json_mutex_unlock(&json_shape_lock);
+
+	return order;
+}
+
+static void json_object_write_canonical_range(JSON_Object *obj,
+	JSON_Sink *sink, size_t begin, size_t end)
+{
+	const uint32_t *order = json_object_canonical_order(obj);
+	size_t i;
 
-	indent_str = json_make_indent_string(indent);
-	json_string_append_printf(str, "%s}\n", indent_str);
-	json_free(indent_str);
+	assert(begin <= end && end <= obj->num_elements);
 
-	return str;
+	for (i = begin; i < end; i++)
+	{
+		if (i > 0)
+			json_sink_putc(sink, ',');
+		json_sink_write_key(sink, obj->shape__->keys[order[i]].key,
+			obj->shape__->keys[order[i]].len);
+		json_value_write(obj->values[order[i]], sink, 0);
+	}
 }
 
-static void json_object_init_buckets(JSON_Object *obj)
+// Writes the members in shape slots `begin` up to `end` as they appear
+// inside the object's braces, each with the separator that goes before it.
+// For canonical output the range is of members in sorted order.
+void json_object_write_range__(JSON_Object *obj, JSON_Sink *sink, int indent,
+	size_t begin, size_t end)
 {
-	obj->buckets = json_malloc(
-		JSON_OBJECT_INITIAL_NUM_BUCKETS * sizeof(struct JSON_BucketLink*));
-	obj->num_buckets = JSON_OBJECT_INITIAL_NUM_BUCKETS;
+	JSON_ObjectIter iter;
+	bool first = true;
+	size_t i;
+
+	if (sink->flags & JSON_WRITE_FLAG_CANONICAL)
+	{
+		json_object_write_canonical_range(obj, sink, begin, end);
+		return;
+	}
+
+	assert(begin <= end && end <= obj->shape__->num_keys);
+
+	// Only the object's first member goes without a comma
+	for (i = begin; first && i > 0; i--)
+		first = json_object_key_is_hole(&obj->shape__->keys[i - 1]);
+
+	json_object_iter_init(&iter, obj);
+	iter.pos__ = begin;
+	while (json_object_iter_next(&iter) && iter.pos__ <= end)
+	{
+		if (!first)
+			json_sink_putc(sink, ',');
+		first = false;
+		json_sink_write_newline(sink, indent + 1);
+		json_sink_write_key(sink, iter.key.str, iter.key.len);
+		json_value_write(iter.value, sink, indent + 1);
+	}
+}
+
+static void json_object_write_members(JSON_Value *value, JSON_Sink *sink, int indent)
+{
+	JSON_Object *obj = JSON_OBJECT(value);
+
+	assert(JSON_IS_OBJECT(value));
+
+	if (obj->num_elements == 0)
+	{
+		json_sink_write(sink, "{}", 2);
+		return;
+	}
+
+	json_sink_putc(sink, '{');
+	if (sink->flags & JSON_WRITE_FLAG_CANONICAL)
+		json_object_write_canonical_range(obj, sink, 0, obj->num_elements);
+	else
+		json_object_write_range__(obj, sink, indent, 0, obj->shape__->num_keys);
+	json_sink_write_newline(sink, indent);
+	json_sink_putc(sink, '}');
+}
+
+static void json_object_write(JSON_Value *value, JSON_Sink *sink, int indent)
+{
+	JSON_CacheLink *link = &JSON_OBJECT(value)->link__;
+	if (json_cache_needed__(value, link))
+		json_cache_write__(value, link, sink, indent, json_object_write_members);
+	else
+		json_object_write_members(value, sink, indent);
 }
 
 JSON_Object *json_object_new(void)
 {
 	JSON_Object *obj = json_value_alloc(JSON_TYPE_OBJECT);
 	if (obj != NULL)
-		json_object_init_buckets(obj);
+		obj->shape__ = json_shape_ref(&json_shape_root);
 	return obj;
 }
 
@@ -152,182 +1087,437 @@ JSON_Object *json_object_init(JSON_Object *obj)
 {
 	assert(obj != NULL);
 	json_value_init(JSON_TYPE_OBJECT, JSON_VALUE(obj));
-	json_object_init_buckets(obj);
+	obj->shape__ = json_shape_ref(&json_shape_root);
 	return obj;
 }
 
-static inline uint32_t json_object_get_bucket_num(JSON_Object *obj, const char *key)
+JSON_Object *json_object_new_with_capacity(size_t n)
 {
-	uint32_t bucket_num = json_strhash(key);
-	if (bucket_num == 0)
-		return 0;
-	return bucket_num % obj->num_buckets;
+	JSON_Object *obj = json_object_new();
+	if (obj != NULL && !json_object_reserve(obj, n))
+	{
+		json_value_unref(obj);
+		return NULL;
+	}
+	return obj;
 }
 
-static inline double json_object_get_load_factor(JSON_Object *obj)
+// Make room for `n` members in total, so that adding up to that many
+// doesn't need any resizing along the way
+bool json_object_reserve(JSON_Object *obj, size_t n)
 {
-	return ((double)obj->num_elements / (double)obj->num_buckets);
+	JSON_Shape *shape;
+	size_t num_slots, reserved;
+
+	assert(JSON_IS_OBJECT(obj));
+
+	shape = obj->shape__;
+
+	if (json_shape_is_shared(shape))
+	{
+		if (n <= JSON_SHAPE_MAX_KEYS)
+		{
+			if (obj->reserved__ < n)
+			{
+				obj->values = json_realloc(obj->values, n * sizeof(JSON_Value*));
+				obj->reserved__ = n;
+			}
+			return true;
+		}
+		// Too many to share a shape, so it might as well go private now
+		json_object_make_private(obj);
+		shape = obj->shape__;
+	}
+
+	num_slots = shape->index.num_slots;
+	if (n > JSON_OBJECT_SMALL_SIZE && json_object_max_elements(num_slots) < n * 2)
+		num_slots = json_object_ideal_num_slots(n);
+	reserved = (shape->reserved < n) ? n : shape->reserved;
+
+	// Holes are squeezed out while at it, since they'd take up room too
+	if (num_slots != shape->index.num_slots || reserved != shape->reserved ||
+	    shape->num_keys != obj->num_elements)
+	{
+		json_object_compact(obj, reserved, num_slots);
+	}
+
+	return true;
 }
 
+// Squeeze out deleted members and size the storage to suit the number of
+// members. Returns false if it was already that way. Objects resize
+// themselves as needed, so this is only useful to get settled storage
+// up-front, eg. before a read-mostly phase.
 bool json_object_rehash(JSON_Object *obj)
 {
-	uint32_t new_num_buckets;
-	double load_factor;
-	size_t i, temp_num_buckets, temp_num_elements;
-	struct JSON_BucketLink **temp_buckets;
-	JSON_Object temp_object;
+	JSON_Shape *shape;
+	size_t num_slots, reserved;
+	bool changed;
 
 	assert(JSON_IS_OBJECT(obj));
 
-	load_factor = json_object_get_load_factor(obj);
-	if ( (load_factor < JSON_OBJECT_REHASH_MAX_LOAD_FACTOR) &&
-	     (load_factor > JSON_OBJECT_REHASH_MIN_LOAD_FACTOR) )
+	shape = obj->shape__;
+
+	if (obj->num_elements == 0)
 	{
-		return false;
+		changed = (shape != &json_shape_root || obj->reserved__ > 0);
+		if (obj->values != NULL)
+			json_free(obj->values);
+		obj->values = NULL;
+		obj->reserved__ = 0;
+		json_shape_unref(shape);
+		obj->shape__ = json_shape_ref(&json_shape_root);
+		return changed;
 	}
 
-	if (load_factor > JSON_OBJECT_REHASH_MAX_LOAD_FACTOR)
+	if (json_shape_is_shared(shape))
 	{
-		new_num_buckets =
-			(uint32_t)((double)obj->num_buckets * JSON_OBJECT_GROW_FACTOR);
-		assert(new_num_buckets > obj->num_buckets);
+		if (obj->reserved__ == shape->num_keys)
+			return false;
+		obj->values = json_realloc(obj->values, shape->num_keys * sizeof(JSON_Value*));
+		obj->reserved__ = shape->num_keys;
+		return true;
 	}
+
+	num_slots = json_object_settled_num_slots(obj->num_elements);
+	reserved = json_object_ideal_num_entries(obj->num_elements);
+	changed = (shape->rehash != NULL || shape->num_keys != obj->num_elements ||
+		num_slots != shape->index.num_slots || reserved != shape->reserved ||
+		(num_slots > 0 && shape->index.growth_left + obj->num_elements !=
+			json_object_max_elements(num_slots)));
+
+	if (changed)
+		json_object_compact(obj, reserved, num_slots);
+
+	return changed;
+}
+
+// When enabled, big objects move their keys to a resized index a few at
+// a time on each modification instead of all at once.
+void json_object_set_incremental(JSON_Object *obj, bool incremental)
+{
+	assert(JSON_IS_OBJECT(obj));
+	if (incremental)
+		JSON_VALUE(obj)->flags |= JSON_VALUE_FLAG_INCREMENTAL;
 	else
 	{
-		new_num_buckets =
-			(uint32_t)((double)obj->num_buckets * JSON_OBJECT_SHRINK_FACTOR);
-		assert(new_num_buckets < obj->num_buckets);
+		JSON_VALUE(obj)->flags &= ~JSON_VALUE_FLAG_INCREMENTAL;
+		json_object_migrate(obj->shape__, SIZE_MAX);
 	}
+}
 
-	json_value_init(JSON_TYPE_OBJECT, JSON_VALUE(&temp_object));
+// Hash a key once up-front for repeated lookups. The key isn't copied,
+// so `str` has to outlive the handle.
+JSON_Key *json_key_init(JSON_Key *key, const char *str, size_t len)
+{
+	assert(key != NULL);
+	assert(str != NULL);
+	assert(len <= UINT32_MAX);
+	key->str = str;
+	key->len = len;
+	key->hash = json_strnhash(str, len);
+	return key;
+}
 
-	temp_object.num_buckets = new_num_buckets;
-	temp_object.buckets = json_malloc(
-		temp_object.num_buckets * sizeof(struct JSON_BucketLink*));
+// Like json_key_init(), but keeps a reference to the interned copy of the
+// key, so that lookups usually match it by pointer. Release it with
+// json_key_clear().
+JSON_Key *json_key_init_interned(JSON_Key *key, const char *str, size_t len)
+{
+	json_key_init(key, str, len);
+	key->str = json_intern(str, len, key->hash);
+	return key;
+}
 
-	if (temp_object.buckets == NULL)
-	{
-		json_value_unref(&temp_object);
-		return false;
-	}
+void json_key_clear(JSON_Key *key)
+{
+	assert(key != NULL);
+	json_intern_unref(key->str);
+	key->str = NULL;
+	key->len = 0;
+}
 
-	for (i = 0; i < obj->num_buckets; i++)
-	{
-		struct JSON_BucketLink *link;
-		for (link = obj->buckets[i]; link != NULL; link = link->next)
-			json_object_set(&temp_object, link->key, json_value_ref(link->value));
-	}
+JSON_Value *json_object_get(JSON_Object *obj, const char *key)
+{
+	assert(key != NULL);
+	return json_object_get_len(obj, key, strlen(key));
+}
+
+// `key` doesn't have to be NUL-terminated
+JSON_Value *json_object_get_len(JSON_Object *obj, const char *key, size_t len)
+{
+	JSON_Key k;
+	return json_object_get_key(obj, json_key_init(&k, key, len));
+}
 
-	temp_num_buckets = obj->num_buckets;
-	temp_num_elements = obj->num_elements;
-	temp_buckets = obj->buckets;
+JSON_Value *json_object_get_key(JSON_Object *obj, const JSON_Key *key)
+{
+	size_t n;
 
-	obj->num_buckets = temp_object.num_buckets;
-	obj->num_elements = temp_object.num_elements;
-	obj->buckets = temp_object.buckets;
+	assert(JSON_IS_OBJECT(obj));
+	assert(key != NULL);
 
-	temp_object.num_buckets = temp_num_buckets;
-	temp_object.num_elements = temp_num_elements;
-	temp_object.buckets = temp_buckets;
-	json_value_unref(&temp_object);
+	n = json_object_lookup(obj->shape__, key);
+	if (n == JSON_OBJECT_NOT_FOUND)
+		return NULL;
 
-	return true;
+	return obj->values[n];
 }
 
-JSON_Value *json_object_get(JSON_Object *obj, const char *key)
+// Like json_object_get_key(), but objects with the same shared shape as
+// the one `cache` was last filled from skip the lookup entirely
+JSON_Value *json_object_get_cached(JSON_Object *obj, const JSON_Key *key,
+	JSON_KeyCache *cache)
 {
-	uint32_t bucket_num;
-	struct JSON_BucketLink *link;
+	JSON_Shape *shape;
+	size_t n;
 
 	assert(JSON_IS_OBJECT(obj));
 	assert(key != NULL);
+	assert(cache != NULL);
+
+	shape = obj->shape__;
 
-	bucket_num = json_object_get_bucket_num(obj, key);
-	assert(bucket_num < obj->num_buckets);
+	// Shared shapes never change, and ids are never reused
+	if (JSON_LIKELY(cache->shape_id == shape->id) && json_shape_is_shared(shape))
+		return obj->values[cache->index];
 
-	for (link = obj->buckets[bucket_num]; link != NULL; link = link->next)
+	n = json_object_lookup(shape, key);
+	if (n == JSON_OBJECT_NOT_FOUND)
+		return NULL;
+
+	if (json_shape_is_shared(shape))
 	{
-		if (json_strequal(key, link->key))
-			return link->value;
+		cache->shape_id = shape->id;
+		cache->index = n;
 	}
 
-	return NULL;
+	return obj->values[n];
 }
 
-// return true if element is added, false if replaced
 bool json_object_set_value(JSON_Object *obj, const char *key, JSON_Value *value)
 {
-	uint32_t bucket_num;
-	struct JSON_BucketLink *link;
+	JSON_Key k;
+	assert(key != NULL);
+	return json_object_set_key(obj, json_key_init(&k, key, strlen(key)), value);
+}
+
+// return true if element is added, false if replaced
+bool json_object_set_key(JSON_Object *obj, const JSON_Key *key, JSON_Value *value)
+{
+	JSON_Shape *shape;
+	size_t i, n;
 
 	assert(JSON_IS_OBJECT(obj));
 	assert(key != NULL);
 	assert(value != NULL);
 
-	bucket_num = json_object_get_bucket_num(obj, key);
-	assert(bucket_num < obj->num_buckets);
+	shape = obj->shape__;
+	json_object_migrate(shape, JSON_OBJECT_MIGRATE_SLOTS);
+	json_cache_touch__(JSON_VALUE(obj));
 
-	// Look for existing
-	for (link = obj->buckets[bucket_num]; link != NULL; link = link->next)
+	// Look for existing, which keeps its place in the order
+	n = json_object_lookup(shape, key);
+	if (n != JSON_OBJECT_NOT_FOUND)
 	{
-		if (json_strequal(key, link->key))
+		JSON_Value *old_value = obj->values[n];
+		json_cache_release__(JSON_VALUE(obj), old_value);
+		json_cache_adopt__(JSON_VALUE(obj), value);
+		obj->values[n] = json_value_ref_sink(value);
+		json_value_unref(old_value);
+		return false;
+	}
+
+	json_cache_adopt__(JSON_VALUE(obj), value);
+
+	// Else move along the shape tree if possible
+	if (json_shape_is_shared(shape))
+	{
+		JSON_Shape *child = json_shape_add_key(shape, key);
+		if (JSON_LIKELY(child != NULL))
 		{
-			json_value_unref(link->value);
-			link->value = json_value_ref_sink(value);
-			return false;
+			n = shape->num_keys;
+			if (obj->reserved__ <= n)
+			{
+				obj->reserved__ = obj->reserved__ ? (obj->reserved__ * 2) :
+					JSON_OBJECT_INITIAL_NUM_ENTRIES;
+				obj->values = json_realloc(obj->values,
+					obj->reserved__ * sizeof(JSON_Value*));
+			}
+			json_shape_unref(shape);
+			obj->shape__ = child;
+			obj->values[n] = json_value_ref_sink(value);
+			obj->num_elements++;
+			return true;
+		}
+		json_object_make_private(obj);
+		shape = obj->shape__;
+	}
+
+	// Small shapes switch to an index once they outgrow the tag word
+	if (shape->index.num_slots == 0 && shape->num_keys == JSON_OBJECT_SMALL_SIZE)
+	{
+		if (obj->num_elements < shape->num_keys)
+			json_object_compact(obj, shape->reserved, 0);
+		else
+			json_object_reindex(shape, json_object_ideal_num_slots(obj->num_elements + 1));
+	}
+
+	json_object_reserve_entry(obj);
+
+	n = shape->num_keys;
+	if (shape->index.num_slots == 0)
+		json_shape_set_tag(shape, n, json_object_h2(key->hash));
+	else
+	{
+		// Reusing a deleted slot doesn't use up room
+		i = json_object_find_free_slot(&shape->index, key->hash);
+		if (shape->index.ctrl[i] == JSON_CTRL_EMPTY &&
+		    JSON_UNLIKELY(shape->index.growth_left == 0))
+		{
+			json_object_grow(obj);
 		}
+		json_object_insert_slot(&shape->index, key->hash, (uint32_t) n);
 	}
 
-	// Else add new element
-	link = json_bucket_link_alloc();
-	link->key = json_strdup(key);
-	link->value = json_value_ref_sink(value);
-	link->next = obj->buckets[bucket_num];
-	obj->buckets[bucket_num] = link;
+	shape->keys[n].hash = key->hash;
+	shape->keys[n].len = (uint32_t) key->len;
+	shape->keys[n].key = json_intern(key->str, key->len, key->hash);
+	obj->values[n] = json_value_ref_sink(value);
+	shape->num_keys++;
 	obj->num_elements++;
+	json_shape_drop_order(shape);
 
 	return true;
 }
 
+// Set `n` members at once, making room for all of them up-front.
+// Returns how many were added rather than replaced.
+size_t json_object_set_many(JSON_Object *obj, const char **keys,
+	JSON_Value **values, size_t n)
+{
+	size_t i, added = 0;
+
+	assert(JSON_IS_OBJECT(obj));
+	assert((keys != NULL && values != NULL) || n == 0);
+
+	if (!json_object_reserve(obj, obj->num_elements + n))
+		return 0;
+
+	for (i = 0; i < n; i++)
+	{
+		if (json_object_set_value(obj, keys[i], values[i]))
+			added++;
+	}
+
+	return added;
+}
+
 bool json_object_del(JSON_Object *obj, const char *key)
 {
-	uint32_t bucket_num;
-	struct JSON_BucketLink *link, *prev = NULL;
+	JSON_Key k;
+	assert(key != NULL);
+	return json_object_del_key(obj, json_key_init(&k, key, strlen(key)));
+}
+
+bool json_object_del_key(JSON_Object *obj, const JSON_Key *key)
+{
+	JSON_Shape *shape;
+	struct JSON_ObjectIndex *ix;
+	size_t i, n;
 
 	assert(JSON_IS_OBJECT(obj));
 	assert(key != NULL);
 
-	bucket_num = json_object_get_bucket_num(obj, key);
-	assert(bucket_num < obj->num_buckets);
+	shape = obj->shape__;
+	json_object_migrate(shape, JSON_OBJECT_MIGRATE_SLOTS);
+
+	n = json_object_lookup(shape, key);
+	if (n == JSON_OBJECT_NOT_FOUND)
+		return false;
+
+	json_cache_touch__(JSON_VALUE(obj));
+	json_cache_release__(JSON_VALUE(obj), obj->values[n]);
 
-	for (link = obj->buckets[bucket_num]; link != NULL; link = link->next)
+	if (json_shape_is_shared(shape))
 	{
-		if (json_strequal(key, link->key))
+		// Removing the last key just goes back up the tree
+		if (n == shape->num_keys - 1)
 		{
-			if (prev != NULL)
-				prev->next = link->next;
-			else // first/head element
-				obj->buckets[bucket_num] = link->next;
-			json_bucket_link_free(link);
+			json_value_unref(obj->values[n]);
+			obj->values[n] = NULL;
+			obj->shape__ = json_shape_ref(shape->parent);
+			json_shape_unref(shape);
 			obj->num_elements--;
 			return true;
 		}
-		prev = link;
+		json_object_make_private(obj);
+		shape = obj->shape__;
 	}
 
-	return false;
+	// Drop the key from wherever it's indexed
+	ix = &shape->index;
+	if (ix->num_slots == 0)
+		json_shape_set_tag(shape, n, JSON_CTRL_EMPTY);
+	else
+	{
+		i = json_object_find(shape, ix, key);
+		if (i == JSON_OBJECT_NOT_FOUND)
+		{
+			ix = &shape->rehash->old;
+			i = json_object_find(shape, ix, key);
+		}
+		assert(i != JSON_OBJECT_NOT_FOUND);
+		json_object_erase_slot(ix, i);
+	}
+
+	json_intern_unref(shape->keys[n].key);
+	shape->keys[n].key = NULL;
+	json_shape_drop_order(shape);
+	json_value_unref(obj->values[n]);
+	obj->values[n] = NULL;
+	obj->num_elements--;
+
+	// Holes at the end can be reused straight away
+	while (shape->num_keys > 0 &&
+	       json_object_key_is_hole(&shape->keys[shape->num_keys - 1]))
+	{
+		shape->num_keys--;
+	}
+
+	json_object_shrink(obj);
+
+	return true;
 }
 
 void json_object_debug_hash(JSON_Object *obj)
 {
-	double load_factor;
+	JSON_Shape *shape;
+	double load_factor = 0.0;
 	assert(JSON_IS_OBJECT(obj));
-	load_factor = json_object_get_load_factor(obj) * 100.0;
+	shape = obj->shape__;
+	if (shape->index.num_slots > 0)
+		load_factor = ((double)obj->num_elements / (double)shape->index.num_slots) * 100.0;
 	json_print("JSON_Object Debug %p", (void*) obj);
 	json_print("-------------------------------------");
-	json_print("  Num Buckets: %u", obj->num_buckets);
-	json_print("  Num Elements: %u", obj->num_elements);
+	if (json_shape_is_shared(shape))
+		json_print("  Shape: shared #%lu", (unsigned long) shape->id);
+	else
+		json_print("  Shape: private");
+	if (shape->index.num_slots == 0)
+		json_print("  Num Slots: none (small)");
+	else
+		json_print("  Num Slots: %lu", (unsigned long) shape->index.num_slots);
+	json_print("  Num Elements: %lu", (unsigned long) obj->num_elements);
+	json_print("  Num Keys: %lu (%lu deleted)", (unsigned long) shape->num_keys,
+		(unsigned long)(shape->num_keys - obj->num_elements));
 	json_print("  Load factor: %f %%", load_factor);
+	if (shape->rehash != NULL)
+	{
+		json_print("  Migrating: %lu of %lu old slots left",
+			(unsigned long)(shape->rehash->old.num_slots - shape->rehash->pos),
+			(unsigned long) shape->rehash->old.num_slots);
+	}
 }
 
 
@@ -343,7 +1533,7 @@ void *json_object_get_class(void)
 		json_object_free,
 		json_object_clone,
 		json_object_equal,
-		json_object_to_string,
+		json_object_write,
 	} };
 	return &json_object_class;
 }
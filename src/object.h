@@ -9,22 +9,93 @@
 extern "C" {
 #endif
 
-struct JSON_BucketLink
+// A member name, interned (see intern.h). Deleted members leave a hole
+// (a NULL key) in private shapes until they're compacted.
+struct JSON_ObjectKey
 {
-	char *key;
-	JSON_Value *value;
-	struct JSON_BucketLink *next;
+	uint32_t hash;
+	uint32_t len;
+	const char *key;
+};
+
+// Keys are found through an open-addressing index of key positions.
+// Each slot has a control byte in `ctrl` which is either empty, deleted,
+// or the top 7 bits of the member's hash, so that probing compares a
+// whole group of slots against the wanted hash at once and only touches
+// the keys that match. Shapes with up to 8 keys have no index and scan
+// a word holding one such tag per key instead.
+struct JSON_ObjectIndex
+{
+	uint8_t *ctrl;
+	uint32_t *slots;
+	size_t num_slots;
+	size_t growth_left;
+};
+
+// A shape is the ordered list of an object's keys, the object itself only
+// holds the values in the same order. Objects given the same keys in the
+// same order share a shape from a tree of transitions, so they store no
+// keys of their own and a key's position can be cached across them.
+// Objects that delete members or outgrow shared shapes get a private
+// shape of their own, which can have holes and resizes as needed.
+typedef struct JSON_Shape JSON_Shape;
+struct JSON_Shape
+{
+	size_t refcount;
+	uint64_t id;                  // 0 for private shapes
+	JSON_Shape *parent;
+	struct JSON_ObjectKey *keys;
+	size_t num_keys;              // including holes
+	size_t reserved;
+	struct JSON_ObjectIndex index;
+	uint64_t tags;
+	struct JSON_ObjectRehash *rehash;
+	JSON_Shape **transitions;
+	size_t num_transitions;
+	uint32_t *order;              // members in canonical order, once needed
 };
 
 typedef struct
 {
 	JSON_Value base__;
-	struct JSON_BucketLink **buckets;
-	size_t num_buckets;
+	JSON_Shape *shape__;
+	JSON_Value **values;  // one per key of the shape, NULL for holes
+	size_t reserved__;
 	size_t num_elements;
+	JSON_CacheLink link__;
 }
 JSON_Object;
 
+// A key hashed up-front, for keys that are looked up over and over
+typedef struct
+{
+	const char *str;
+	size_t len;
+	uint32_t hash;
+}
+JSON_Key;
+
+// Where a key was last found, to skip the lookup in objects of the same
+// shared shape. Zero it before first use and only use it with one key.
+typedef struct
+{
+	uint64_t shape_id;
+	size_t index;
+}
+JSON_KeyCache;
+
+// Walks an object's members in order without allocating or touching
+// reference counts, `key` and `value` are borrowed. The object mustn't be
+// modified while iterating.
+typedef struct
+{
+	JSON_Key key;
+	JSON_Value *value;
+	JSON_Object *obj__;
+	size_t pos__;
+}
+JSON_ObjectIter;
+
 #define JSON_OBJECT(v)    ((JSON_Object*)(v))
 #define JSON_TYPE_OBJECT  json_object_get_class()
 #define JSON_IS_OBJECT(v) JSON_LIKELY(((v) != NULL) && (JSON_VALUE_CLASS(v) == JSON_TYPE_OBJECT))
@@ -32,15 +103,38 @@ JSON_Object;
 void *json_object_get_class(void);
 JSON_Object *json_object_new(void);
 JSON_Object *json_object_init(JSON_Object *obj);
+JSON_Object *json_object_new_with_capacity(size_t n);
+bool json_object_reserve(JSON_Object *obj, size_t n);
 
 JSON_Value *json_object_get(JSON_Object *obj, const char *key);
+JSON_Value *json_object_get_len(JSON_Object *obj, const char *key, size_t len);
 bool json_object_set_value(JSON_Object *obj, const char *key, JSON_Value *value);
 bool json_object_del(JSON_Object *obj, const char *key);
+size_t json_object_set_many(JSON_Object *obj, const char **keys,
+	JSON_Value **values, size_t n);
+
+JSON_Key *json_key_init(JSON_Key *key, const char *str, size_t len);
+JSON_Key *json_key_init_interned(JSON_Key *key, const char *str, size_t len);
+void json_key_clear(JSON_Key *key);
+JSON_Value *json_object_get_key(JSON_Object *obj, const JSON_Key *key);
+bool json_object_set_key(JSON_Object *obj, const JSON_Key *key, JSON_Value *value);
+bool json_object_del_key(JSON_Object *obj, const JSON_Key *key);
+JSON_Value *json_object_get_cached(JSON_Object *obj, const JSON_Key *key,
+	JSON_KeyCache *cache);
 
 #define json_object_set(obj, key, value) \
 	json_object_set_value(JSON_OBJECT(obj), key, JSON_VALUE(value))
 
+void json_object_iter_init(JSON_ObjectIter *iter, JSON_Object *obj);
+bool json_object_iter_next(JSON_ObjectIter *iter);
+
+// For parallel.c, ranges are of shape slots, or of members in sorted
+// order for canonical output
+void json_object_write_range__(JSON_Object *obj, JSON_Sink *sink, int indent,
+	size_t begin, size_t end);
+
 bool json_object_rehash(JSON_Object *obj);
+void json_object_set_incremental(JSON_Object *obj, bool incremental);
 
 // TODO: remove this
 void json_object_debug_hash(JSON_Object *obj);
@@ -0,0 +1,258 @@
+#define _POSIX_C_SOURCE 200809L
+#include "parallel.h"
+#include "array.h"
+#include "object.h"
+#include "util.h"
+#include <unistd.h>
+
+// More runs than threads, so that a thread which got cheap elements goes
+// on to take another run
+#define JSON_PARALLEL_RUNS_PER_THREAD 4
+
+struct JSON_ParallelRun
+{
+	size_t begin;
+	size_t end;
+	JSON_String text;
+	bool failed;
+};
+
+struct JSON_ParallelJob
+{
+	JSON_Value *value;
+	int flags;
+	int indent;
+	struct JSON_ParallelRun *runs;
+	size_t num_runs;
+	size_t next_run;
+	JSON_Mutex lock;
+};
+
+static size_t json_parallel_threads(size_t threads)
+{
+#ifdef JSON_ENABLE_THREADS
+	long n;
+	if (threads == 0)
+	{
+		n = sysconf(_SC_NPROCESSORS_ONLN);
+		threads = (n > 0) ? (size_t) n : 1;
+	}
+	return threads;
+#else
+	(void) threads;
+	return 1;
+#endif
+}
+
+static void json_parallel_write_run(struct JSON_ParallelJob *job,
+	struct JSON_ParallelRun *run)
+{
+	JSON_Sink sink;
+
+	json_sink_init_string(&sink, &run->text);
+	sink.flags = job->flags;
+	sink.parallel__ = true;
+
+	if (JSON_IS_ARRAY(job->value))
+	{
+		json_array_write_range__(JSON_ARRAY(job->value), &sink, job->indent,
+			run->begin, run->end);
+	}
+	else
+	{
+		json_object_write_range__(JSON_OBJECT(job->value), &sink, job->indent,
+			run->begin, run->end);
+	}
+
+	run->failed = !json_sink_flush(&sink);
+}
+
+static void *json_parallel_worker(void *data)
+{
+	struct JSON_ParallelJob *job = data;
+	size_t i;
+
+	for (;;)
+	{
+		json_mutex_lock(&job->lock);
+		i = job->next_run;
+		if (i < job->num_runs)
+			job->next_run++;
+		json_mutex_unlock(&job->lock);
+
+		if (i == job->num_runs)
+			break;
+		json_parallel_write_run(job, &job->runs[i]);
+	}
+
+	return NULL;
+}
+
+// Writes all of the runs, the calling thread being one of the workers.
+// Threads that can't be started are simply done without.
+static void json_parallel_run(struct JSON_ParallelJob *job, size_t threads)
+{
+#ifdef JSON_ENABLE_THREADS
+	pthread_t *ids = json_malloc((threads - 1) * sizeof(pthread_t));
+	size_t i, started = 0;
+
+	for (i = 0; i < threads - 1; i++)
+	{
+		if (pthread_create(&ids[i], NULL, json_parallel_worker, job) != 0)
+			break;
+		started++;
+	}
+
+	json_parallel_worker(job);
+
+	for (i = 0; i < started; i++)
+		pthread_join(ids[i], NULL);
+	json_free(ids);
+#else
+	(void) threads;
+	json_parallel_worker(job);
+#endif
+}
+
+// Writes the elements of `v` into runs, returns false if it isn't worth
+// doing on more than one thread
+static bool json_parallel_begin(struct JSON_ParallelJob *job, const void *v,
+	int flags, int indent, size_t threads)
+{
+	JSON_Value *value = JSON_VALUE(v);
+	size_t count, slots, i;
+
+	if (threads < 2)
+		return false;
+	else if (JSON_IS_ARRAY(value))
+	{
+		count = JSON_ARRAY(value)->size;
+		slots = count;
+	}
+	else if (JSON_IS_OBJECT(value))
+	{
+		// Canonical output has the members in sorted order instead
+		count = JSON_OBJECT(value)->num_elements;
+		if (flags & JSON_WRITE_FLAG_CANONICAL)
+			slots = count;
+		else
+			slots = JSON_OBJECT(value)->shape__->num_keys;
+	}
+	else
+		return false;
+
+	if (count < JSON_PARALLEL_MIN_ELEMENTS)
+		return false;
+
+	job->value = value;
+	job->flags = flags;
+	job->indent = indent;
+	job->num_runs = threads * JSON_PARALLEL_RUNS_PER_THREAD;
+	if (job->num_runs > slots)
+		job->num_runs = slots;
+	job->next_run = 0;
+	json_mutex_init(&job->lock);
+
+	job->runs = json_malloc(job->num_runs * sizeof(struct JSON_ParallelRun));
+	// The first `slots % num_runs` runs get one more slot than the rest
+	for (i = 0; i < job->num_runs; i++)
+	{
+		struct JSON_ParallelRun *run = &job->runs[i];
+		size_t extra = slots % job->num_runs;
+		run->begin = (slots / job->num_runs) * i + ((i < extra) ? i : extra);
+		run->end = run->begin + slots / job->num_runs + ((i < extra) ? 1 : 0);
+		json_string_init(&run->text);
+	}
+
+	if (threads > job->num_runs)
+		threads = job->num_runs;
+	json_parallel_run(job, threads);
+	return true;
+}
+
+// Writes the whole value, the runs in between its brackets
+static void json_parallel_emit(struct JSON_ParallelJob *job, JSON_Sink *sink)
+{
+	bool array = JSON_IS_ARRAY(job->value);
+	size_t i;
+
+	json_sink_putc(sink, array ? '[' : '{');
+	for (i = 0; i < job->num_runs; i++)
+	{
+		if (job->runs[i].failed)
+		{
+			json_sink_fail(sink);
+			return;
+		}
+		json_sink_write(sink, job->runs[i].text.str, job->runs[i].text.len);
+	}
+	json_sink_write_newline(sink, job->indent);
+	json_sink_putc(sink, array ? ']' : '}');
+}
+
+static void json_parallel_end(struct JSON_ParallelJob *job)
+{
+	size_t i;
+	for (i = 0; i < job->num_runs; i++)
+		json_value_unref(&job->runs[i].text);
+	json_free(job->runs);
+	json_mutex_destroy(&job->lock);
+}
+
+// Like json_value_write(), sinks that flush write each run's buffer
+// straight through rather than copying it
+bool json_value_write_parallel(const void *v, JSON_Sink *sink, int indent,
+	size_t threads)
+{
+	struct JSON_ParallelJob job;
+
+	assert(v != NULL);
+	assert(sink != NULL);
+
+	threads = json_parallel_threads(threads);
+	if (!json_parallel_begin(&job, v, sink->flags, indent, threads))
+		return json_value_write(v, sink, indent);
+
+	json_parallel_emit(&job, sink);
+	json_parallel_end(&job);
+	return !sink->failed;
+}
+
+// Like json_value_serialize(), the runs are copied once into the result at
+// offsets summed from their sizes
+char *json_value_serialize_parallel(const void *v, int flags, size_t threads,
+	size_t *len)
+{
+	struct JSON_ParallelJob job;
+	JSON_Sink sink;
+	size_t size;
+	char *buf;
+
+	assert(v != NULL);
+
+	threads = json_parallel_threads(threads);
+	if (!json_parallel_begin(&job, v, flags, 0, threads))
+		return json_value_serialize(v, flags, len);
+
+	json_sink_init_counter(&sink);
+	sink.flags = flags;
+	json_parallel_emit(&job, &sink);
+	if (sink.failed)
+	{
+		json_parallel_end(&job);
+		return NULL;
+	}
+	size = json_sink_tell(&sink);
+
+	buf = json_malloc(size + 1);
+	json_sink_init_buffer(&sink, buf, size, NULL, NULL);
+	sink.flags = flags;
+	json_parallel_emit(&job, &sink);
+	assert(sink.len == size && !sink.failed);
+	json_parallel_end(&job);
+
+	buf[size] = '\0';
+	if (len != NULL)
+		*len = size;
+	return buf;
+}
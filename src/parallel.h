@@ -0,0 +1,35 @@
+#ifndef JSON_PARALLEL_H_
+#define JSON_PARALLEL_H_
+
+#include "value.h"
+#include "sink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Writing big documents on several threads. The elements of a top-level
+// array or object are cut into runs which worker threads write into
+// buffers of their own, and the buffers are then written out in order, so
+// the text is byte for byte what json_value_write() gives. Values with
+// fewer than JSON_PARALLEL_MIN_ELEMENTS elements, and all values when the
+// library is built without JSON_ENABLE_THREADS, are written on the
+// calling thread. A `threads` of 0 means one per online CPU.
+//
+// The document mustn't be modified meanwhile. Cached text (see cache.h)
+// is used and kept up to date as usual, except for the top-level value
+// and for anything in a shared container, which more than one thread
+// could reach and is written uncached.
+
+#define JSON_PARALLEL_MIN_ELEMENTS 4096
+
+bool json_value_write_parallel(const void *v, JSON_Sink *sink, int indent,
+	size_t threads);
+char *json_value_serialize_parallel(const void *v, int flags, size_t threads,
+	size_t *len);
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // JSON_PARALLEL_H_
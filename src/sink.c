@@ -0,0 +1,662 @@
+#define _POSIX_C_SOURCE 200809L
+#include "sink.h"
+#include "util.h"
+#include "format.h"
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef JSON_HAVE_SSE2
+# include <emmintrin.h>
+#endif
+
+// Smallest buffer a string sink grows to
+#define JSON_SINK_MIN_GROWTH 64
+
+// Size of the buffers a gather copies output into
+#define JSON_SINK_GATHER_CHUNK_SIZE 65536
+
+// Borrowed runs shorter than this are copied all the same, since another
+// region costs more than copying them would
+#define JSON_SINK_MIN_BORROW 4096
+
+#define JSON_SINK_SPACES_16 "                "
+
+// Indentation is sliced from here rather than built for every line, a
+// newline followed by enough spaces for 64 levels
+static const char json_sink_indent[] = "\n"
+	JSON_SINK_SPACES_16 JSON_SINK_SPACES_16 JSON_SINK_SPACES_16 JSON_SINK_SPACES_16
+	JSON_SINK_SPACES_16 JSON_SINK_SPACES_16 JSON_SINK_SPACES_16 JSON_SINK_SPACES_16;
+
+#define JSON_SINK_NUM_SPACES (sizeof(json_sink_indent) - 2)
+
+static void json_sink_clear(JSON_Sink *sink)
+{
+	memset(sink, 0, sizeof(*sink));
+	sink->fd__ = -1;
+}
+
+// Nothing more gets written once a sink has failed, making the buffer look
+// full sends every write to the slow path which ignores it. Writers call
+// this for values they find can't be written.
+void json_sink_fail(JSON_Sink *sink)
+{
+	sink->failed = true;
+	sink->size = sink->len;
+}
+
+// Appends to `str`, which is only guaranteed to be complete and terminated
+// after json_sink_flush()
+void json_sink_init_string(JSON_Sink *sink, JSON_String *str)
+{
+	assert(sink != NULL);
+	assert(JSON_IS_STRING(str));
+	json_sink_clear(sink);
+	sink->str__ = str;
+	sink->buf = str->str;
+	sink->len = str->len;
+	sink->size = str->reserved__;
+}
+
+// Writes into `buf`, passing it to `flush` whenever it fills up. Without a
+// flush function the sink fails when the output doesn't fit, leaving
+// `len` bytes of it in `buf`.
+void json_sink_init_buffer(JSON_Sink *sink, char *buf, size_t size,
+	JSON_SinkFlushFunc flush, void *user_data)
+{
+	assert(sink != NULL);
+	assert(buf != NULL || size == 0);
+	json_sink_clear(sink);
+	sink->buf = buf;
+	sink->size = size;
+	sink->flush__ = flush;
+	sink->user_data__ = user_data;
+}
+
+static bool json_sink_flush_file(void *user_data, const char *data, size_t len)
+{
+	JSON_Sink *sink = user_data;
+	return (fwrite(data, 1, len, sink->fp__) == len);
+}
+
+void json_sink_init_file(JSON_Sink *sink, FILE *fp)
+{
+	assert(fp != NULL);
+	json_sink_init_buffer(sink, sink->inline__, JSON_SINK_INLINE_SIZE,
+		json_sink_flush_file, sink);
+	sink->fp__ = fp;
+}
+
+// `user_data` points at the descriptor
+static bool json_sink_flush_fd(void *user_data, const char *data, size_t len)
+{
+	int fd = *(int*) user_data;
+	while (len > 0)
+	{
+		ssize_t n = write(fd, data, len);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += n;
+		len -= n;
+	}
+	return true;
+}
+
+void json_sink_init_fd(JSON_Sink *sink, int fd)
+{
+	assert(fd >= 0);
+	json_sink_init_buffer(sink, sink->inline__, JSON_SINK_INLINE_SIZE,
+		json_sink_flush_fd, &sink->fd__);
+	sink->fd__ = fd;
+}
+
+// Fills the caller's regions in order, each one completely before moving
+// on to the next, failing if the output doesn't fit in all of them. The
+// regions aren't copied, so they have to outlive the sink.
+void json_sink_init_iovec(JSON_Sink *sink, const struct iovec *iov, size_t count)
+{
+	assert(iov != NULL || count == 0);
+	if (count == 0)
+	{
+		json_sink_init_buffer(sink, NULL, 0, NULL, NULL);
+		return;
+	}
+	json_sink_init_buffer(sink, iov[0].iov_base, iov[0].iov_len, NULL, NULL);
+	sink->iov__ = iov + 1;
+	sink->iov_count__ = count - 1;
+}
+
+static bool json_sink_discard(void *user_data, const char *data, size_t len)
+{
+	(void)user_data;
+	(void)data;
+	(void)len;
+	return true;
+}
+
+#define json_sink_is_counter(sink) ((sink)->flush__ == json_sink_discard)
+
+// Keeps nothing but the number of bytes written, see json_sink_tell().
+// Small pieces still go through the built-in buffer, but long strings are
+// only scanned.
+void json_sink_init_counter(JSON_Sink *sink)
+{
+	json_sink_init_buffer(sink, sink->inline__, JSON_SINK_INLINE_SIZE,
+		json_sink_discard, NULL);
+}
+
+void json_gather_init(JSON_Gather *gather)
+{
+	assert(gather != NULL);
+	memset(gather, 0, sizeof(*gather));
+}
+
+// Frees the regions and the buffers, leaving an empty gather
+void json_gather_clear(JSON_Gather *gather)
+{
+	size_t i;
+
+	assert(gather != NULL);
+
+	for (i = 0; i < gather->num_chunks__; i++)
+		json_free(gather->chunks__[i]);
+	if (gather->chunks__ != NULL)
+		json_free(gather->chunks__);
+	if (gather->iov != NULL)
+		json_free(gather->iov);
+	json_gather_init(gather);
+}
+
+// Adds a region, or extends the last one if `data` follows straight on
+static void json_gather_push(JSON_Gather *gather, const char *data, size_t len)
+{
+	struct iovec *last;
+
+	if (len == 0)
+		return;
+
+	gather->total += len;
+
+	if (gather->count > 0)
+	{
+		last = &gather->iov[gather->count - 1];
+		if ((const char*) last->iov_base + last->iov_len == data)
+		{
+			last->iov_len += len;
+			return;
+		}
+	}
+
+	if (gather->count == gather->reserved__)
+	{
+		gather->reserved__ = gather->reserved__ ? (gather->reserved__ * 2) : 16;
+		gather->iov = json_realloc(gather->iov,
+			gather->reserved__ * sizeof(struct iovec));
+	}
+
+	gather->iov[gather->count].iov_base = (void*) data;
+	gather->iov[gather->count].iov_len = len;
+	gather->count++;
+}
+
+// Writes all of the regions to `fd`, as many at a time as writev() takes.
+// Returns false on error, with some of the output possibly written.
+bool json_gather_write_fd(JSON_Gather *gather, int fd)
+{
+	const struct iovec *iov = gather->iov;
+	size_t count = gather->count, batch;
+	long max = sysconf(_SC_IOV_MAX);
+	const char *rest;
+	ssize_t n;
+
+	assert(gather != NULL);
+
+	// POSIX promises at least 16
+	if (max < 16)
+		max = 16;
+
+	while (count > 0)
+	{
+		batch = (count < (size_t) max) ? count : (size_t) max;
+		n = writev(fd, iov, (int) batch);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+
+		for (; count > 0 && (size_t) n >= iov->iov_len; iov++, count--)
+			n -= iov->iov_len;
+
+		// The rest of a region that was only partly written
+		if (n > 0)
+		{
+			rest = (const char*) iov->iov_base + n;
+			if (!json_sink_flush_fd(&fd, rest, iov->iov_len - n))
+				return false;
+			iov++;
+			count--;
+		}
+	}
+
+	return true;
+}
+
+// Ends the region of copied bytes being built up in the current buffer
+static void json_sink_gather_cut(JSON_Sink *sink)
+{
+	json_gather_push(sink->gather__, sink->buf + sink->gather_start__,
+		sink->len - sink->gather_start__);
+	sink->gather_start__ = sink->len;
+}
+
+// Moves on to a new buffer with room for at least `needed` bytes, the
+// full one is kept since regions point into it
+static void json_sink_gather_grow(JSON_Sink *sink, size_t needed)
+{
+	JSON_Gather *gather = sink->gather__;
+	size_t size = JSON_SINK_GATHER_CHUNK_SIZE;
+
+	if (size < needed)
+		size = needed;
+
+	json_sink_gather_cut(sink);
+	sink->flushed__ += sink->len;
+
+	gather->chunks__ = json_realloc(gather->chunks__,
+		(gather->num_chunks__ + 1) * sizeof(char*));
+	gather->chunks__[gather->num_chunks__++] = json_malloc(size);
+
+	sink->buf = gather->chunks__[gather->num_chunks__ - 1];
+	sink->size = size;
+	sink->len = 0;
+	sink->gather_start__ = 0;
+}
+
+// Adds the output to the end of `gather` rather than copying it into one
+// place. Nothing is added until the sink is flushed.
+void json_sink_init_gather(JSON_Sink *sink, JSON_Gather *gather)
+{
+	assert(sink != NULL);
+	assert(gather != NULL);
+	json_sink_clear(sink);
+	sink->gather__ = gather;
+	sink->flushed__ = gather->total;
+}
+
+// The string's length has to be right before it's reallocated, since only
+// that much of it gets moved
+static bool json_sink_grow_string(JSON_Sink *sink, size_t needed)
+{
+	JSON_String *str = sink->str__;
+	size_t capacity = sink->size * 2;
+
+	if (capacity < JSON_SINK_MIN_GROWTH)
+		capacity = JSON_SINK_MIN_GROWTH;
+	if (capacity < sink->len + needed)
+		capacity = sink->len + needed;
+	if (capacity >= UINT32_MAX && sink->len + needed < UINT32_MAX)
+		capacity = UINT32_MAX - 1;
+
+	str->len = sink->len;
+	str->str[str->len] = '\0';
+	if (!json_string_reserve(str, capacity))
+		return false;
+
+	sink->buf = str->str;
+	sink->size = str->reserved__;
+	return true;
+}
+
+// Hands the buffered output to the flush function
+static bool json_sink_drain(JSON_Sink *sink)
+{
+	if (sink->len > 0 && !sink->flush__(sink->user_data__, sink->buf, sink->len))
+		return false;
+	sink->flushed__ += sink->len;
+	sink->len = 0;
+	return true;
+}
+
+// Fills the current region and carries on in the next ones
+static bool json_sink_next_region(JSON_Sink *sink, const char **data, size_t *len)
+{
+	while (*len > sink->size - sink->len)
+	{
+		size_t room = sink->size - sink->len;
+		if (room > 0)
+		{
+			memcpy(sink->buf + sink->len, *data, room);
+			*data += room;
+			*len -= room;
+			sink->len = sink->size;
+		}
+		if (sink->iov_count__ == 0)
+			return false;
+		sink->flushed__ += sink->len;
+		sink->buf = sink->iov__->iov_base;
+		sink->size = sink->iov__->iov_len;
+		sink->len = 0;
+		sink->iov__++;
+		sink->iov_count__--;
+	}
+	return true;
+}
+
+void json_sink_write_slow__(JSON_Sink *sink, const char *data, size_t len)
+{
+	size_t room;
+
+	if (sink->failed)
+		return;
+
+	if (sink->str__ != NULL)
+	{
+		if (!json_sink_grow_string(sink, len))
+		{
+			json_sink_fail(sink);
+			return;
+		}
+	}
+	else if (sink->iov__ != NULL)
+	{
+		if (!json_sink_next_region(sink, &data, &len))
+		{
+			json_sink_fail(sink);
+			return;
+		}
+	}
+	else if (sink->gather__ != NULL)
+		json_sink_gather_grow(sink, len);
+	else if (sink->flush__ != NULL)
+	{
+		if (!json_sink_drain(sink))
+		{
+			json_sink_fail(sink);
+			return;
+		}
+		// Too big to be worth buffering
+		if (len >= sink->size)
+		{
+			if (!sink->flush__(sink->user_data__, data, len))
+				json_sink_fail(sink);
+			else
+				sink->flushed__ += len;
+			return;
+		}
+	}
+	else
+	{
+		// Keep as much as fits
+		room = sink->size - sink->len;
+		if (room > 0)
+		{
+			memcpy(sink->buf + sink->len, data, room);
+			sink->len += room;
+		}
+		json_sink_fail(sink);
+		return;
+	}
+
+	memcpy(sink->buf + sink->len, data, len);
+	sink->len += len;
+}
+
+// Pushes out anything still buffered, or for string sinks sets the
+// string's length and terminates it. Returns false if anything written to
+// the sink was lost.
+bool json_sink_flush(JSON_Sink *sink)
+{
+	assert(sink != NULL);
+
+	if (sink->str__ != NULL)
+	{
+		sink->str__->len = sink->len;
+		sink->str__->str[sink->len] = '\0';
+	}
+	else if (sink->gather__ != NULL)
+		json_sink_gather_cut(sink);
+	else if (sink->flush__ != NULL && !sink->failed)
+	{
+		if (!json_sink_drain(sink))
+			json_sink_fail(sink);
+		else if (sink->fp__ != NULL && fflush(sink->fp__) != 0)
+			json_sink_fail(sink);
+	}
+
+	return !sink->failed;
+}
+
+// Bytes written so far, including any that are still buffered. For string
+// sinks it's the length of the whole string.
+size_t json_sink_tell(JSON_Sink *sink)
+{
+	assert(sink != NULL);
+	return sink->flushed__ + sink->len;
+}
+
+// Spaces for `level` levels of nesting, nothing in compact output
+void json_sink_write_indent(JSON_Sink *sink, int level)
+{
+	size_t n;
+
+	if (sink->flags & JSON_WRITE_FLAGS_COMPACT)
+		return;
+
+	for (n = (size_t) level * JSON_INDENT_WIDTH; n > JSON_SINK_NUM_SPACES;
+	     n -= JSON_SINK_NUM_SPACES)
+	{
+		json_sink_write(sink, json_sink_indent + 1, JSON_SINK_NUM_SPACES);
+	}
+	json_sink_write(sink, json_sink_indent + 1, n);
+}
+
+// Starts a line nested `level` levels deep, nothing in compact output
+void json_sink_write_newline(JSON_Sink *sink, int level)
+{
+	size_t n;
+
+	if (sink->flags & JSON_WRITE_FLAGS_COMPACT)
+		return;
+
+	n = (size_t) level * JSON_INDENT_WIDTH;
+	if (JSON_LIKELY(n <= JSON_SINK_NUM_SPACES))
+		json_sink_write(sink, json_sink_indent, n + 1);
+	else
+	{
+		json_sink_putc(sink, '\n');
+		json_sink_write_indent(sink, level);
+	}
+}
+
+// What follows the backslash when escaping each byte, 0 for bytes that are
+// written as they are. Quotes, backslashes and control characters are all
+// that JSON requires escaping, everything else including UTF-8 sequences
+// passes through.
+static const char json_sink_escapes[256] =
+{
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'b', 't', 'n', 'u', 'f', 'r', 'u', 'u',
+	'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u', 'u',
+	['"'] = '"',
+	['\\'] = '\\',
+};
+
+#define json_sink_needs_escape(c) (json_sink_escapes[(uint8_t)(c)] != 0)
+
+// Number of bytes at the start of `s` that need no escaping. Long clean
+// runs are the common case, so this skips 16 bytes (or a word) at a time
+// until it reaches a block with something to escape, and only that block
+// is searched byte by byte.
+static size_t json_sink_clean_run(const char *s, size_t len)
+{
+	size_t i = 0;
+
+#ifdef JSON_HAVE_SSE2
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i*)(s + i));
+		// Bytes up to 0x1F are the ones left unchanged by an unsigned max
+		__m128i m = _mm_or_si128(
+			_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash)),
+			_mm_cmpeq_epi8(_mm_max_epu8(v, control), control));
+		if (_mm_movemask_epi8(m) != 0)
+			break;
+	}
+#else
+	const uint64_t ones = 0x0101010101010101ULL;
+	const uint64_t highs = 0x8080808080808080ULL;
+
+	for (; i + 8 <= len; i += 8)
+	{
+		uint64_t w, q, b;
+		memcpy(&w, s + i, sizeof(w));
+		q = w ^ (ones * '"');
+		b = w ^ (ones * '\\');
+		if ((((w - ones * 0x20) & ~w) |
+		     ((q - ones) & ~q) |
+		     ((b - ones) & ~b)) & highs)
+		{
+			break;
+		}
+	}
+#endif
+
+	for (; i < len; i++)
+	{
+		if (json_sink_needs_escape(s[i]))
+			break;
+	}
+	return i;
+}
+
+// Writes `len` bytes that stay where they are until the output has been
+// used, which gather sinks point at rather than copy. Other sinks copy
+// them as usual.
+void json_sink_write_borrowed(JSON_Sink *sink, const char *data, size_t len)
+{
+	if (sink->gather__ == NULL || len < JSON_SINK_MIN_BORROW || sink->failed)
+	{
+		json_sink_write(sink, data, len);
+		return;
+	}
+
+	json_sink_gather_cut(sink);
+	json_gather_push(sink->gather__, data, len);
+	sink->flushed__ += len;
+}
+
+// Writes `s` as a quoted JSON string, copying runs that need no escaping
+// in one go
+static void json_sink_write_quoted_runs(JSON_Sink *sink, const char *s, size_t len,
+	bool borrowed)
+{
+	static const char hex[] = "0123456789abcdef";
+	char esc[6] = { '\\', 0, '0', '0', 0, 0 };
+	size_t n;
+
+	// Only the length matters
+	if (json_sink_is_counter(sink))
+	{
+		sink->flushed__ += len + 2;
+		while (len > 0)
+		{
+			n = json_sink_clean_run(s, len);
+			if (n == len)
+				break;
+			sink->flushed__ += (json_sink_escapes[(uint8_t) s[n]] == 'u') ? 5 : 1;
+			s += n + 1;
+			len -= n + 1;
+		}
+		return;
+	}
+
+	json_sink_putc(sink, '"');
+
+	while (len > 0)
+	{
+		n = json_sink_clean_run(s, len);
+		if (borrowed)
+			json_sink_write_borrowed(sink, s, n);
+		else
+			json_sink_write(sink, s, n);
+		if (n == len)
+			break;
+
+		esc[1] = json_sink_escapes[(uint8_t) s[n]];
+		if (esc[1] == 'u')
+		{
+			esc[4] = hex[(uint8_t) s[n] >> 4];
+			esc[5] = hex[(uint8_t) s[n] & 0xF];
+			json_sink_write(sink, esc, 6);
+		}
+		else
+			json_sink_write(sink, esc, 2);
+
+		s += n + 1;
+		len -= n + 1;
+	}
+
+	json_sink_putc(sink, '"');
+}
+
+void json_sink_write_quoted(JSON_Sink *sink, const char *s, size_t len)
+{
+	json_sink_write_quoted_runs(sink, s, len, false);
+}
+
+// Like json_sink_write_quoted(), the runs between escapes are borrowed as
+// in json_sink_write_borrowed()
+void json_sink_write_quoted_borrowed(JSON_Sink *sink, const char *s, size_t len)
+{
+	json_sink_write_quoted_runs(sink, s, len, true);
+}
+
+// A member's quoted key and the colon after it
+void json_sink_write_key(JSON_Sink *sink, const char *key, size_t len)
+{
+	json_sink_write_quoted(sink, key, len);
+	if (sink->flags & JSON_WRITE_FLAGS_COMPACT)
+		json_sink_putc(sink, ':');
+	else
+		json_sink_write(sink, ": ", 2);
+}
+
+// Numbers are formatted in place when there's room in the buffer, which
+// there nearly always is
+void json_sink_write_int64(JSON_Sink *sink, int64_t value)
+{
+	char buf[JSON_FORMAT_INT64_SIZE];
+	if (JSON_UNLIKELY(sink->flags & JSON_WRITE_FLAG_CANONICAL))
+		json_sink_write(sink, buf, json_format_int64_canonical(buf, value));
+	else if (JSON_LIKELY(sink->size - sink->len >= JSON_FORMAT_INT64_SIZE))
+		sink->len += json_format_int64(sink->buf + sink->len, value);
+	else
+		json_sink_write(sink, buf, json_format_int64(buf, value));
+}
+
+// Canonical output has no way to write NaN or the infinities and fails
+void json_sink_write_double(JSON_Sink *sink, double value)
+{
+	char buf[JSON_FORMAT_DOUBLE_SIZE];
+	size_t n;
+
+	if (JSON_UNLIKELY(sink->flags & JSON_WRITE_FLAG_CANONICAL))
+	{
+		n = json_format_double_canonical(buf, value);
+		if (n == 0)
+			json_sink_fail(sink);
+		json_sink_write(sink, buf, n);
+	}
+	else if (JSON_LIKELY(sink->size - sink->len >= JSON_FORMAT_DOUBLE_SIZE))
+		sink->len += json_format_double(sink->buf + sink->len, value);
+	else
+		json_sink_write(sink, buf, json_format_double(buf, value));
+}
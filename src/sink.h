@@ -0,0 +1,134 @@
+#ifndef JSON_SINK_H_
+#define JSON_SINK_H_
+
+#include "value.h"
+#include "string.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Where serialized text goes. Output is written into `buf` and only when
+// that fills up does the sink do anything else: a string sink grows the
+// string it's writing into, an iovec sink moves on to the next region, a
+// gather sink starts another buffer of its gather's, and others hand the
+// buffered bytes to a flush function and start over.
+// Errors are sticky, once a flush fails or a fixed buffer runs out every
+// later write is ignored and `failed` stays set, so writers only need to
+// check at the end.
+
+// How values are laid out. The default is pretty-printed, indented by
+// JSON_INDENT_WIDTH spaces per level, compact output has no whitespace.
+// Canonical output is the RFC 8785 form for hashing and comparing, it's
+// compact, members are sorted by key and numbers written the way
+// ECMAScript writes them.
+enum JSON_WriteFlag
+{
+	JSON_WRITE_FLAG_NONE      = 0,
+	JSON_WRITE_FLAG_COMPACT   = (1<<0),
+	JSON_WRITE_FLAG_CANONICAL = (1<<1),
+};
+
+// Flags that leave out whitespace
+#define JSON_WRITE_FLAGS_COMPACT (JSON_WRITE_FLAG_COMPACT | JSON_WRITE_FLAG_CANONICAL)
+
+// Size of the buffer built into the sink, used for files and descriptors
+#define JSON_SINK_INLINE_SIZE 1024
+
+// Output kept as a list of regions to hand to writev() or sendmsg(), see
+// json_sink_init_gather(). Long string values aren't copied, their regions
+// point into the strings themselves, so the document has to stay alive and
+// unchanged until the output has been used. Everything else is copied
+// into buffers that belong to the gather.
+typedef struct
+{
+	struct iovec *iov;
+	size_t count;
+	size_t total;                 // bytes in all of the regions
+	size_t reserved__;
+	char **chunks__;
+	size_t num_chunks__;
+}
+JSON_Gather;
+
+struct JSON_Sink_
+{
+	char *buf;
+	size_t len;
+	size_t size;
+	bool failed;
+	int flags;                    // JSON_WriteFlag, set before writing
+	JSON_SinkFlushFunc flush__;
+	void *user_data__;
+	size_t flushed__;
+	bool shared__;                // wrote a shared container, see cache.h
+	bool parallel__;              // other threads write the same document
+	size_t uncached__;            // inside a shared container while parallel
+	JSON_String *str__;
+	const struct iovec *iov__;
+	size_t iov_count__;
+	FILE *fp__;
+	int fd__;
+	JSON_Gather *gather__;
+	size_t gather_start__;        // where the region being copied begins
+	char inline__[JSON_SINK_INLINE_SIZE];
+};
+
+void json_sink_init_string(JSON_Sink *sink, JSON_String *str);
+void json_sink_init_buffer(JSON_Sink *sink, char *buf, size_t size,
+	JSON_SinkFlushFunc flush, void *user_data);
+void json_sink_init_file(JSON_Sink *sink, FILE *fp);
+void json_sink_init_fd(JSON_Sink *sink, int fd);
+void json_sink_init_iovec(JSON_Sink *sink, const struct iovec *iov, size_t count);
+void json_sink_init_counter(JSON_Sink *sink);
+void json_sink_init_gather(JSON_Sink *sink, JSON_Gather *gather);
+bool json_sink_flush(JSON_Sink *sink);
+void json_sink_fail(JSON_Sink *sink);
+size_t json_sink_tell(JSON_Sink *sink);
+
+void json_sink_write_slow__(JSON_Sink *sink, const char *data, size_t len);
+void json_sink_write_indent(JSON_Sink *sink, int level);
+void json_sink_write_newline(JSON_Sink *sink, int level);
+void json_sink_write_quoted(JSON_Sink *sink, const char *s, size_t len);
+void json_sink_write_borrowed(JSON_Sink *sink, const char *data, size_t len);
+void json_sink_write_quoted_borrowed(JSON_Sink *sink, const char *s, size_t len);
+void json_sink_write_key(JSON_Sink *sink, const char *key, size_t len);
+void json_sink_write_int64(JSON_Sink *sink, int64_t value);
+void json_sink_write_double(JSON_Sink *sink, double value);
+
+void json_gather_init(JSON_Gather *gather);
+void json_gather_clear(JSON_Gather *gather);
+bool json_gather_write_fd(JSON_Gather *gather, int fd);
+
+static inline void json_sink_write(JSON_Sink *sink, const char *data, size_t len)
+{
+	if (JSON_UNLIKELY(sink->size - sink->len < len))
+	{
+		json_sink_write_slow__(sink, data, len);
+		return;
+	}
+	memcpy(sink->buf + sink->len, data, len);
+	sink->len += len;
+}
+
+static inline void json_sink_putc(JSON_Sink *sink, char c)
+{
+	if (JSON_UNLIKELY(sink->len == sink->size))
+	{
+		json_sink_write_slow__(sink, &c, 1);
+		return;
+	}
+	sink->buf[sink->len++] = c;
+}
+
+#define json_sink_write_cstr(sink, s) \
+	json_sink_write(sink, s, strlen(s))
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // JSON_SINK_H_
@@ -1,13 +1,68 @@
 #include "string.h"
 #include "util.h"
+#include "sink.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <string.h>
 
+#define json_string_is_inline(s) ((s)->str == (s)->inline__)
+
 static void json_string_free(JSON_Value *str)
 {
 	assert(str);
-	json_free(JSON_STRING(str)->str);
+	if (!json_string_is_inline(JSON_STRING(str)))
+		json_free(JSON_STRING(str)->str);
+}
+
+static inline void json_string_init_buffer(JSON_String *str)
+{
+	str->str = str->inline__;
+	str->str[0] = '\0';
+	str->len = 0;
+	str->reserved__ = JSON_STRING_INLINE_SIZE - 1;
+}
+
+// Move the contents to a heap buffer with room for `capacity` characters
+// plus the terminating NUL.
+static bool json_string_realloc(JSON_String *str, size_t capacity)
+{
+	char *tmp;
+
+	if (json_string_is_inline(str))
+	{
+		tmp = json_malloc(capacity + 1);
+		if (tmp != NULL)
+			memcpy(tmp, str->str, str->len + 1);
+	}
+	else
+		tmp = json_realloc(str->str, capacity + 1);
+
+	if (tmp == NULL)
+		return false;
+
+	str->str = tmp;
+	str->reserved__ = capacity;
+	return true;
+}
+
+// Like json_string_reserve() but grows geometrically so that repeated
+// appends/prepends don't realloc every time.
+static bool json_string_grow(JSON_String *str, size_t len)
+{
+	size_t capacity;
+
+	if (len <= str->reserved__)
+		return true;
+	else if (len >= UINT32_MAX)
+		return false;
+
+	capacity = (size_t)str->reserved__ * 2;
+	if (capacity < len)
+		capacity = len;
+	if (capacity >= UINT32_MAX)
+		capacity = UINT32_MAX - 1;
+
+	return json_string_realloc(str, capacity);
 }
 
 static JSON_Value *json_string_clone(JSON_Value *str)
@@ -15,7 +70,7 @@ static JSON_Value *json_string_clone(JSON_Value *str)
 	JSON_String *new_str;
 	assert(str);
 	assert(JSON_IS_STRING(str));
-	new_str = json_string_new(json_string_cstr(JSON_STRING(str)));
+	new_str = json_string_new_length(JSON_STRING(str)->str, JSON_STRING(str)->len);
 	return JSON_VALUE(new_str);
 }
 
@@ -29,25 +84,18 @@ static bool json_string_equal(const JSON_Value *value1, const JSON_Value *value2
 	str1 = JSON_STRING(value1);
 	str2 = JSON_STRING(value2);
 
-	if (!str1->str || !str2->str)
+	if (str1->len != str2->len)
 		return false;
 
-	return json_strequal(str1->str, str2->str);
+	return (memcmp(str1->str, str2->str, str1->len) == 0);
 }
 
-static JSON_String *json_string_to_string(JSON_Value *value, int indent)
+static void json_string_write(JSON_Value *value, JSON_Sink *sink, int indent)
 {
-	JSON_String *str;
-	char *indent_str;
-
 	assert(JSON_IS_STRING(value));
-
-	indent_str = json_make_indent_string(indent);
-	str = json_string_new_printf("%s\"%s\"", indent_str,
-		json_string_cstr(JSON_STRING(value)));
-	json_free(indent_str);
-
-	return str;
+	(void)indent;
+	json_sink_write_quoted_borrowed(sink, JSON_STRING(value)->str,
+		JSON_STRING(value)->len);
 }
 
 JSON_String *json_string_new(const char *str)
@@ -63,16 +111,8 @@ JSON_String *json_string_new_length(const char *str, size_t len)
 	JSON_String *s = json_value_alloc(JSON_TYPE_STRING);
 	if (s)
 	{
-		if (!str || !len)
-		{
-			s->len = 0;
-			s->str = json_strdup("");
-		}
-		else
-		{
-			s->len = len;
-			s->str = json_strndup(str, s->len);
-		}
+		json_string_init_buffer(s);
+		json_string_assign_length(s, str, len);
 	}
 	return s;
 }
@@ -109,12 +149,21 @@ size_t json_string_length(JSON_String *str)
 	return str->len;
 }
 
+bool json_string_reserve(JSON_String *str, size_t len)
+{
+	assert(JSON_IS_STRING(str));
+	if (len <= str->reserved__)
+		return true;
+	else if (len >= UINT32_MAX)
+		return false;
+	return json_string_realloc(str, len);
+}
+
 JSON_String *json_string_init(JSON_String *str)
 {
 	assert(str != NULL);
 	json_value_init(JSON_TYPE_STRING, JSON_VALUE(str));
-	str->len = 0;
-	str->str = json_strdup("");
+	json_string_init_buffer(str);
 	return str;
 }
 
@@ -135,29 +184,15 @@ void json_string_assign(JSON_String *str, const char *s)
 
 void json_string_assign_length(JSON_String *str, const char *s, size_t len)
 {
-	char *tmp;
 	assert(str);
-	if (s && len)
-	{
-		tmp = json_realloc(str->str, len + 1);
-		if (tmp != NULL)
-		{
-			str->str = tmp;
-			str->len = len;
-			strncpy(str->str, s, len);
-			str->str[str->len] = '\0';
-		}
-	}
-	else
-	{
-		tmp = json_realloc(str->str, 1);
-		if (tmp != NULL)
-		{
-			str->str = tmp;
-			str->len = 0;
-			str->str[str->len] = '\0';
-		}
-	}
+	if (!s)
+		len = 0;
+	if (!json_string_reserve(str, len))
+		return;
+	if (len > 0)
+		memmove(str->str, s, len);
+	str->len = len;
+	str->str[str->len] = '\0';
 }
 
 void json_string_assign_printf(JSON_String *str, const char *fmt, ...)
@@ -199,7 +234,6 @@ void json_string_append_cstr(JSON_String *str, const char *str2)
 void json_string_append_cstr_length(JSON_String *str, const char *str2, size_t len)
 {
 	size_t new_len;
-	char *tmp;
 
 	assert(JSON_IS_STRING(str));
 	assert(str2);
@@ -208,11 +242,9 @@ void json_string_append_cstr_length(JSON_String *str, const char *str2, size_t l
 		return;
 
 	new_len = str->len + len;
-	tmp = json_realloc(str->str, new_len + 1);
-	if (tmp != NULL)
+	if (json_string_grow(str, new_len))
 	{
-		str->str = tmp;
-		strncpy(str->str + str->len, str2, len);
+		memcpy(str->str + str->len, str2, len);
 		str->len = new_len;
 		str->str[str->len] = '\0';
 	}
@@ -264,7 +296,6 @@ void json_string_prepend_cstr(JSON_String *str, const char *str2)
 void json_string_prepend_cstr_length(JSON_String *str, const char *str2, size_t len)
 {
 	size_t new_len;
-	char *tmp;
 
 	assert(JSON_IS_STRING(str));
 	assert(str2);
@@ -273,10 +304,8 @@ void json_string_prepend_cstr_length(JSON_String *str, const char *str2, size_t
 		return;
 
 	new_len = str->len + len;
-	tmp = json_realloc(str->str, new_len + 1);
-	if (tmp != NULL)
+	if (json_string_grow(str, new_len))
 	{
-		str->str = tmp;
 		memmove(str->str + len, str->str, new_len - len);
 		memcpy(str->str, str2, len);
 		str->len = new_len;
@@ -333,26 +362,15 @@ JSON_String *json_string_lstrip(JSON_String *str)
 JSON_String *json_string_rstrip(JSON_String *str)
 {
 	size_t len;
-	char *temp;
 
 	assert(JSON_IS_STRING(str));
 
 	len = str->len;
-	while (--len)
-	{
-		if (isspace(str->str[len]))
-			str->str[len] = '\0';
-		else
-			break;
-	}
+	while (len > 0 && isspace((unsigned char) str->str[len - 1]))
+		len--;
 
-	temp = json_realloc(str->str, len + 1);
-	if (temp != NULL)
-	{
-		str->str = temp;
-		str->len = len;
-		str->str[str->len] = '\0';
-	}
+	str->len = len;
+	str->str[str->len] = '\0';
 
 	return str;
 }
@@ -369,7 +387,7 @@ void *json_string_get_class(void)
 		json_string_free,
 		json_string_clone,
 		json_string_equal,
-		json_string_to_string,
+		json_string_write,
 	} };
 	return &json_string_class;
 }
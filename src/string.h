@@ -8,12 +8,19 @@
 extern "C" {
 #endif
 
+// Strings shorter than this (including the terminating NUL) are stored
+// in the string node itself instead of in a separate heap buffer. The
+// `str` member always points at the live buffer, so a JSON_String must
+// never be copied by value.
+#define JSON_STRING_INLINE_SIZE 16
+
 struct JSON_String_
 {
 	JSON_Value base__;
 	char *str;
 	uint32_t len;
 	uint32_t reserved__;
+	char inline__[JSON_STRING_INLINE_SIZE];
 };
 
 #define JSON_STRING(v)    ((JSON_String*)(v))
@@ -28,6 +35,7 @@ JSON_String *json_string_new_vprintf(const char *fmt, va_list ap);
 JSON_String *json_string_init(JSON_String *str);
 
 size_t json_string_length(JSON_String *str);
+bool json_string_reserve(JSON_String *str, size_t len);
 const char *json_string_cstr(JSON_String *str);
 void json_string_assign(JSON_String *str, const char *s);
 void json_string_assign_length(JSON_String *str, const char *s, size_t len);
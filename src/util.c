@@ -1,6 +1,7 @@
 #include "util.h"
 #include "value.h"
 #include <stdio.h>
+#include <time.h>
 
 #define JSON_ABORT_OOM(ptr)          \
 do {                                 \
@@ -106,15 +107,151 @@ char *json_strndup(const char *other, size_t n)
 	return buf;
 }
 
-// Source: http://www.cse.yorku.ca/~oz/hash.html
+// Key hashing is SipHash-1-3 keyed with a per-process secret, so that
+// untrusted input can't be crafted to make object keys collide.
+// Source: https://github.com/veorq/SipHash
+
+static struct JSON_HashSeed
+{
+	bool initialized;
+	uint64_t k0;
+	uint64_t k1;
+}
+json_hash_seed = { false, 0, 0 };
+
+#ifdef JSON_ENABLE_THREADS
+static pthread_once_t json_hash_seed_once = PTHREAD_ONCE_INIT;
+#endif
+
+static uint64_t json_splitmix64(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+// Every object key is hashed with this, so it has to be called before any
+// objects are created, and before any threads are started.
+void json_set_hash_seed(uint64_t seed)
+{
+	json_hash_seed.k0 = json_splitmix64(&seed);
+	json_hash_seed.k1 = json_splitmix64(&seed);
+	json_hash_seed.initialized = true;
+}
+
+static void json_hash_seed_init(void)
+{
+	uint64_t seed[2] = { 0, 0 };
+	FILE *fp;
+
+	// Already set with json_set_hash_seed()
+	if (json_hash_seed.initialized)
+		return;
+
+	fp = fopen("/dev/urandom", "rb");
+	if (fp != NULL)
+	{
+		size_t n = fread(seed, sizeof(seed), 1, fp);
+		fclose(fp);
+		if (n == 1)
+		{
+			json_hash_seed.k0 = seed[0];
+			json_hash_seed.k1 = seed[1];
+			json_hash_seed.initialized = true;
+			return;
+		}
+	}
+
+	// Not as good, but still differs from run to run
+	seed[0] = (uint64_t) time(NULL) ^ ((uint64_t) clock() << 32) ^
+		(uint64_t)(uintptr_t) &seed ^ (uint64_t)(uintptr_t) json_hash_seed_init;
+	json_set_hash_seed(seed[0]);
+}
+
+#define JSON_ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+
+#define JSON_SIPROUND(v0, v1, v2, v3) \
+	do { \
+		v0 += v1; v1 = JSON_ROTL64(v1, 13); v1 ^= v0; v0 = JSON_ROTL64(v0, 32); \
+		v2 += v3; v3 = JSON_ROTL64(v3, 16); v3 ^= v2; \
+		v0 += v3; v3 = JSON_ROTL64(v3, 21); v3 ^= v0; \
+		v2 += v1; v1 = JSON_ROTL64(v1, 17); v1 ^= v2; v2 = JSON_ROTL64(v2, 32); \
+	} while (false)
+
 uint32_t json_strhash(const char *s)
 {
-	uint32_t hash = 0;
-	int c;
 	assert(s);
-	while ( (c = *s++) )
-		hash = c + (hash << 6) + (hash << 16) - hash;
-	return hash;
+	return json_strnhash(s, strlen(s));
+}
+
+uint32_t json_strnhash(const char *s, size_t n)
+{
+	const uint8_t *p = (const uint8_t*) s;
+	const uint8_t *end = p + (n & ~(size_t) 7);
+	uint64_t v0, v1, v2, v3, m, b;
+
+	assert(s);
+
+#ifdef JSON_ENABLE_THREADS
+	pthread_once(&json_hash_seed_once, json_hash_seed_init);
+#else
+	if (JSON_UNLIKELY(!json_hash_seed.initialized))
+		json_hash_seed_init();
+#endif
+
+	v0 = json_hash_seed.k0 ^ 0x736F6D6570736575ULL;
+	v1 = json_hash_seed.k1 ^ 0x646F72616E646F6DULL;
+	v2 = json_hash_seed.k0 ^ 0x6C7967656E657261ULL;
+	v3 = json_hash_seed.k1 ^ 0x7465646279746573ULL;
+
+	// A word at a time, the byte order doesn't matter within a process
+	for (; p != end; p += 8)
+	{
+		memcpy(&m, p, sizeof(m));
+		v3 ^= m;
+		JSON_SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+	}
+
+	b = ((uint64_t) n) << 56;
+	switch (n & 7)
+	{
+		case 7: b |= ((uint64_t) p[6]) << 48; // fall through
+		case 6: b |= ((uint64_t) p[5]) << 40; // fall through
+		case 5: b |= ((uint64_t) p[4]) << 32; // fall through
+		case 4: b |= ((uint64_t) p[3]) << 24; // fall through
+		case 3: b |= ((uint64_t) p[2]) << 16; // fall through
+		case 2: b |= ((uint64_t) p[1]) << 8;  // fall through
+		case 1: b |= ((uint64_t) p[0]);       break;
+		case 0: break;
+	}
+
+	v3 ^= b;
+	JSON_SIPROUND(v0, v1, v2, v3);
+	v0 ^= b;
+
+	v2 ^= 0xFF;
+	JSON_SIPROUND(v0, v1, v2, v3);
+	JSON_SIPROUND(v0, v1, v2, v3);
+	JSON_SIPROUND(v0, v1, v2, v3);
+
+	m = v0 ^ v1 ^ v2 ^ v3;
+	return (uint32_t)(m ^ (m >> 32));
+}
+
+// Whether `d` is a whole number that fits in an int64_t, storing it in
+// `out` if so.
+bool json_double_to_int64(double d, int64_t *out)
+{
+	// 2^63 is exactly representable, anything below it converts safely
+	if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0))
+		return false;
+	else if ((double)(int64_t) d != d)
+		return false;
+	if (out != NULL)
+		*out = (int64_t) d;
+	return true;
 }
 
 bool json_strequal(const char *s1, const char *s2)
@@ -126,16 +263,6 @@ bool json_strequal(const char *s1, const char *s2)
 	return (strcmp(s1, s2) == 0);
 }
 
-char *json_make_indent_string(int level)
-{
-	size_t n_chars = level * JSON_INDENT_WIDTH;
-	char *out = json_malloc(n_chars + 1);
-	if (n_chars > 0)
-		memset(out, ' ', n_chars);
-	out[n_chars] = '\0';
-	return out;
-}
-
 // Adapated from vsnprintf()
 char *json_strvprintf(const char *fmt, va_list ap_in)
 {
@@ -13,6 +13,42 @@
 extern "C" {
 #endif
 
+#ifdef JSON_ENABLE_THREADS
+# include <pthread.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+# define JSON_HAVE_SSE2 1
+#endif
+
+// Locking for process-wide tables and worker threads, a no-op unless the
+// library is built with JSON_ENABLE_THREADS
+#ifdef JSON_ENABLE_THREADS
+typedef pthread_mutex_t JSON_Mutex;
+# define JSON_MUTEX_INIT PTHREAD_MUTEX_INITIALIZER
+# define json_mutex_init(m) pthread_mutex_init(m, NULL)
+# define json_mutex_destroy(m) pthread_mutex_destroy(m)
+# define json_mutex_lock(m) pthread_mutex_lock(m)
+# define json_mutex_unlock(m) pthread_mutex_unlock(m)
+#else
+typedef int JSON_Mutex;
+# define JSON_MUTEX_INIT 0
+# define json_mutex_init(m) ((void)(*(m) = 0))
+# define json_mutex_destroy(m) ((void)(m))
+# define json_mutex_lock(m) ((void)(m))
+# define json_mutex_unlock(m) ((void)(m))
+#endif
+
+// Publishing a pointer to data filled in beforehand, for readers that
+// check it without taking the lock that guards the store
+#ifdef JSON_ENABLE_THREADS
+# define json_load_acquire(p) __atomic_load_n(p, __ATOMIC_ACQUIRE)
+# define json_store_release(p, v) __atomic_store_n(p, v, __ATOMIC_RELEASE)
+#else
+# define json_load_acquire(p) (*(p))
+# define json_store_release(p, v) ((void)(*(p) = (v)))
+#endif
+
 typedef void* (*JSON_AllocMallocFunc)(size_t);
 typedef void* (*JSON_AllocReallocFunc)(void*, size_t);
 typedef void (*JSON_AllocFreeFunc)(void*);
@@ -28,6 +64,9 @@ void json_free(void *ptr);
 char *json_strdup(const char *s);
 char *json_strndup(const char *s, size_t n);
 uint32_t json_strhash(const char *s);
+uint32_t json_strnhash(const char *s, size_t n);
+void json_set_hash_seed(uint64_t seed);
+bool json_double_to_int64(double d, int64_t *out);
 bool json_strequal(const char *s1, const char *s2);
 char *json_strprintf(const char *fmt, ...);
 char *json_strvprintf(const char *fmt, va_list ap);
@@ -36,7 +75,6 @@ void json_print(const char *fmt, ...);
 void json_printerr(const char *fmt, ...);
 
 #define JSON_INDENT_WIDTH 2
-char *json_make_indent_string(int level);
 
 #ifdef __cplusplus
 } // extern "C"
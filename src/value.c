@@ -1,6 +1,7 @@
 #include "value.h"
 #include "util.h"
 #include "string.h"
+#include "sink.h"
 #include <stdarg.h>
 
 void *json_value_init(void *class_, JSON_Value *value)
@@ -74,15 +75,99 @@ bool json_value_equal(const void *v1, const void *v2)
 	return false;
 }
 
-JSON_String *json_value_to_string(const void *v, int indent)
+// Serializes `v` in a single pass, as if nested `indent` levels deep,
+// without allocating anything. Returns false if the sink has failed, it
+// isn't flushed.
+bool json_value_write(const void *v, JSON_Sink *sink, int indent)
 {
 	JSON_ValueClass *value_class;
 	assert(v != NULL);
+	assert(sink != NULL);
 	value_class = JSON_VALUE_CLASS(v);
 	assert(value_class != NULL);
-	if (value_class->to_string)
-		return value_class->to_string(JSON_VALUE(v), indent);
-	return json_string_new("");
+	if (value_class->write)
+		value_class->write(JSON_VALUE(v), sink, indent);
+	return !sink->failed;
+}
+
+// `flags` are JSON_WriteFlag values. Returns NULL if `v` can't be written
+// that way, which is only the case for canonical output of NaN or the
+// infinities.
+JSON_String *json_value_to_string_flags(const void *v, int indent, int flags)
+{
+	JSON_String *str = json_string_new(NULL);
+	JSON_Sink sink;
+	json_sink_init_string(&sink, str);
+	sink.flags = flags;
+	json_sink_write_indent(&sink, indent);
+	json_value_write(v, &sink, indent);
+	if (!json_sink_flush(&sink))
+	{
+		json_value_unref(str);
+		return NULL;
+	}
+	return str;
+}
+
+JSON_String *json_value_to_string(const void *v, int indent)
+{
+	return json_value_to_string_flags(v, indent, JSON_WRITE_FLAG_NONE);
+}
+
+// The exact number of bytes json_value_write() would produce, found
+// without keeping any of them. Numbers are still formatted, but strings
+// are only scanned for characters needing escapes.
+size_t json_value_serialized_size(const void *v, int flags)
+{
+	JSON_Sink sink;
+	json_sink_init_counter(&sink);
+	sink.flags = flags;
+	json_value_write(v, &sink, 0);
+	return json_sink_tell(&sink);
+}
+
+// Serializes into a single buffer of exactly the right size, allocated
+// once and NUL-terminated, its length not counting the NUL is stored in
+// `len` if it's not NULL. Free it with json_free(). Returns NULL where
+// json_value_to_string_flags() does.
+char *json_value_serialize(const void *v, int flags, size_t *len)
+{
+	JSON_Sink sink;
+	size_t size;
+	char *buf;
+
+	json_sink_init_counter(&sink);
+	sink.flags = flags;
+	if (!json_value_write(v, &sink, 0))
+		return NULL;
+	size = json_sink_tell(&sink);
+	buf = json_malloc(size + 1);
+
+	json_sink_init_buffer(&sink, buf, size, NULL, NULL);
+	sink.flags = flags;
+	json_value_write(v, &sink, 0);
+	assert(sink.len == size && !sink.failed);
+
+	buf[size] = '\0';
+	if (len != NULL)
+		*len = size;
+	return buf;
+}
+
+// Feeds the canonical form of `v` to `update` a buffer at a time, to hash
+// it without keeping the text. Returns false if `update` fails or `v` has
+// no canonical form.
+bool json_value_digest(const void *v, JSON_SinkFlushFunc update, void *user_data)
+{
+	JSON_Sink sink;
+
+	assert(update != NULL);
+
+	json_sink_init_buffer(&sink, sink.inline__, JSON_SINK_INLINE_SIZE, update,
+		user_data);
+	sink.flags = JSON_WRITE_FLAG_CANONICAL;
+	json_value_write(v, &sink, 0);
+	return json_sink_flush(&sink);
 }
 
 void *json_value_ref(void *v)
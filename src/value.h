@@ -14,25 +14,35 @@ extern "C" {
 # define JSON_API_FUNC      __attribute__((visibility("default")))
 # define JSON_LIKELY(x)     __builtin_expect(!!(x), 1)
 # define JSON_UNLIKELY(x)   __builtin_expect(!!(x), 0)
+# define JSON_PREFETCH(p)   __builtin_prefetch(p)
 #else // TODO: hand dllexport or whatever else
 # define JSON_INTERNAL_FUNC
 # define JSON_API_FUNC
 # define JSON_LIKELY(x) (x)
 # define JSON_UNLIKELY(x) (x)
+# define JSON_PREFETCH(p) ((void)(p))
 #endif
 
 typedef struct JSON_Value_ JSON_Value;
 typedef struct JSON_String_ JSON_String;
+typedef struct JSON_Sink_ JSON_Sink;
 typedef void (*JSON_FreeFunc)(JSON_Value*);
 typedef JSON_Value* (*JSON_CloneFunc)(JSON_Value*);
 typedef bool (*JSON_EqualFunc)(const JSON_Value*, const JSON_Value*);
-typedef JSON_String* (*JSON_ToStringFunc)(JSON_Value*, int);
+typedef void (*JSON_WriteFunc)(JSON_Value*, JSON_Sink*, int);
+
+// Consumes `len` bytes of output, returns false on error
+typedef bool (*JSON_SinkFlushFunc)(void *user_data, const char *data, size_t len);
 
 enum JSON_ValueFlag
 {
-	JSON_VALUE_FLAG_NONE     = (1<<0),
-	JSON_VALUE_FLAG_FLOATING = (1<<1),
-	JSON_VALUE_FLAG_ON_HEAP  = (1<<2),
+	JSON_VALUE_FLAG_NONE        = (1<<0),
+	JSON_VALUE_FLAG_FLOATING    = (1<<1),
+	JSON_VALUE_FLAG_ON_HEAP     = (1<<2),
+	JSON_VALUE_FLAG_READONLY    = (1<<3),
+	JSON_VALUE_FLAG_INTEGER     = (1<<4), // JSON_Number holding an int64_t
+	JSON_VALUE_FLAG_INCREMENTAL = (1<<5), // JSON_Object resizing gradually
+	JSON_VALUE_FLAG_SHARED      = (1<<6), // container in more than one place
 };
 
 struct JSON_Value_
@@ -48,7 +58,7 @@ typedef struct
 	JSON_FreeFunc free;
 	JSON_CloneFunc clone;
 	JSON_EqualFunc equal;
-	JSON_ToStringFunc to_string;
+	JSON_WriteFunc write;
 }
 JSON_ValueClass;
 
@@ -63,6 +73,11 @@ void *json_value_init(void *class_, JSON_Value *value);
 void *json_value_clone(const void *v);
 bool json_value_equal(const void *v1, const void *v2);
 JSON_String *json_value_to_string(const void *v, int indent);
+JSON_String *json_value_to_string_flags(const void *v, int indent, int flags);
+bool json_value_write(const void *v, JSON_Sink *sink, int indent);
+size_t json_value_serialized_size(const void *v, int flags);
+char *json_value_serialize(const void *v, int flags, size_t *len);
+bool json_value_digest(const void *v, JSON_SinkFlushFunc update, void *user_data);
 
 void *json_value_ref(void *v);
 void *json_value_ref_sink(void *v);
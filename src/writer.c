@@ -0,0 +1,197 @@
+#include "writer.h"
+#include "util.h"
+
+#define json_writer_in_object(w) \
+	((w)->objects__[((w)->depth__ - 1) / 8] & (1u << (((w)->depth__ - 1) % 8)))
+
+void json_writer_init(JSON_Writer *writer, JSON_Sink *sink)
+{
+	assert(writer != NULL);
+	assert(sink != NULL);
+	memset(writer, 0, sizeof(*writer));
+	writer->sink = sink;
+}
+
+// Whether a complete document was written and made it to the sink, which
+// isn't flushed
+bool json_writer_finish(JSON_Writer *writer)
+{
+	assert(writer != NULL);
+	return writer->done__ && writer->depth__ == 0 && !writer->sink->failed;
+}
+
+// Checks a value is allowed here and writes whatever goes before it
+static bool json_writer_before_value(JSON_Writer *writer)
+{
+	if (writer->depth__ == 0)
+		return !writer->done__;
+
+	if (json_writer_in_object(writer))
+	{
+		// The key already wrote the separator
+		if (!writer->after_key__)
+			return false;
+		writer->after_key__ = false;
+		return true;
+	}
+
+	if (!writer->empty__)
+		json_sink_putc(writer->sink, ',');
+	json_sink_write_newline(writer->sink, (int) writer->depth__);
+	writer->empty__ = false;
+	return true;
+}
+
+static void json_writer_after_value(JSON_Writer *writer)
+{
+	if (writer->depth__ == 0)
+		writer->done__ = true;
+}
+
+static bool json_writer_begin(JSON_Writer *writer, bool object, char c)
+{
+	size_t depth = writer->depth__;
+
+	if (depth == JSON_WRITER_MAX_DEPTH || !json_writer_before_value(writer))
+		return false;
+
+	if (object)
+		writer->objects__[depth / 8] |= (uint8_t)(1u << (depth % 8));
+	else
+		writer->objects__[depth / 8] &= (uint8_t) ~(1u << (depth % 8));
+
+	writer->depth__++;
+	writer->empty__ = true;
+	json_sink_putc(writer->sink, c);
+	return true;
+}
+
+static bool json_writer_end(JSON_Writer *writer, bool object, char c)
+{
+	if (writer->depth__ == 0 || writer->after_key__ ||
+	    !json_writer_in_object(writer) != !object)
+	{
+		return false;
+	}
+
+	writer->depth__--;
+	if (!writer->empty__)
+		json_sink_write_newline(writer->sink, (int) writer->depth__);
+	json_sink_putc(writer->sink, c);
+
+	// The parent has this container in it
+	writer->empty__ = false;
+	json_writer_after_value(writer);
+	return true;
+}
+
+bool json_writer_begin_object(JSON_Writer *writer)
+{
+	assert(writer != NULL);
+	return json_writer_begin(writer, true, '{');
+}
+
+bool json_writer_end_object(JSON_Writer *writer)
+{
+	assert(writer != NULL);
+	return json_writer_end(writer, true, '}');
+}
+
+bool json_writer_begin_array(JSON_Writer *writer)
+{
+	assert(writer != NULL);
+	return json_writer_begin(writer, false, '[');
+}
+
+bool json_writer_end_array(JSON_Writer *writer)
+{
+	assert(writer != NULL);
+	return json_writer_end(writer, false, ']');
+}
+
+bool json_writer_key(JSON_Writer *writer, const char *key, size_t len)
+{
+	assert(writer != NULL);
+	assert(key != NULL || len == 0);
+
+	if (writer->depth__ == 0 || !json_writer_in_object(writer) ||
+	    writer->after_key__)
+	{
+		return false;
+	}
+
+	if (!writer->empty__)
+		json_sink_putc(writer->sink, ',');
+	json_sink_write_newline(writer->sink, (int) writer->depth__);
+	json_sink_write_key(writer->sink, key, len);
+
+	writer->empty__ = false;
+	writer->after_key__ = true;
+	return true;
+}
+
+bool json_writer_null(JSON_Writer *writer)
+{
+	assert(writer != NULL);
+	if (!json_writer_before_value(writer))
+		return false;
+	json_sink_write(writer->sink, "null", 4);
+	json_writer_after_value(writer);
+	return true;
+}
+
+bool json_writer_bool(JSON_Writer *writer, bool value)
+{
+	assert(writer != NULL);
+	if (!json_writer_before_value(writer))
+		return false;
+	if (value)
+		json_sink_write(writer->sink, "true", 4);
+	else
+		json_sink_write(writer->sink, "false", 5);
+	json_writer_after_value(writer);
+	return true;
+}
+
+bool json_writer_int64(JSON_Writer *writer, int64_t value)
+{
+	assert(writer != NULL);
+	if (!json_writer_before_value(writer))
+		return false;
+	json_sink_write_int64(writer->sink, value);
+	json_writer_after_value(writer);
+	return true;
+}
+
+bool json_writer_double(JSON_Writer *writer, double value)
+{
+	assert(writer != NULL);
+	if (!json_writer_before_value(writer))
+		return false;
+	json_sink_write_double(writer->sink, value);
+	json_writer_after_value(writer);
+	return true;
+}
+
+bool json_writer_string(JSON_Writer *writer, const char *str, size_t len)
+{
+	assert(writer != NULL);
+	assert(str != NULL || len == 0);
+	if (!json_writer_before_value(writer))
+		return false;
+	json_sink_write_quoted(writer->sink, str, len);
+	json_writer_after_value(writer);
+	return true;
+}
+
+// Writes a whole tree as the next value
+bool json_writer_value(JSON_Writer *writer, const void *value)
+{
+	assert(writer != NULL);
+	assert(value != NULL);
+	if (!json_writer_before_value(writer))
+		return false;
+	json_value_write(value, writer->sink, (int) writer->depth__);
+	json_writer_after_value(writer);
+	return true;
+}
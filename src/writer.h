@@ -0,0 +1,61 @@
+#ifndef JSON_WRITER_H_
+#define JSON_WRITER_H_
+
+#include "value.h"
+#include "sink.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Emits JSON into a sink one piece at a time, without building a tree
+// first. The output is laid out exactly as json_value_write() would lay
+// out the same document, following the sink's flags.
+//
+// Calls that would produce invalid JSON, like a key inside an array, a
+// value where an object expects a key, mismatched ends or a second
+// top-level value, write nothing and return false. Nesting is tracked
+// with one bit per level. Sink errors are only reported by
+// json_writer_finish(). For canonical output members have to be written
+// in sorted order, the writer doesn't reorder them.
+
+#define JSON_WRITER_MAX_DEPTH 512
+
+typedef struct
+{
+	JSON_Sink *sink;
+	size_t depth__;
+	bool empty__;                 // nothing written at this level yet
+	bool after_key__;
+	bool done__;                  // the top-level value is complete
+	uint8_t objects__[JSON_WRITER_MAX_DEPTH / 8];
+}
+JSON_Writer;
+
+void json_writer_init(JSON_Writer *writer, JSON_Sink *sink);
+bool json_writer_finish(JSON_Writer *writer);
+
+bool json_writer_begin_object(JSON_Writer *writer);
+bool json_writer_end_object(JSON_Writer *writer);
+bool json_writer_begin_array(JSON_Writer *writer);
+bool json_writer_end_array(JSON_Writer *writer);
+bool json_writer_key(JSON_Writer *writer, const char *key, size_t len);
+
+bool json_writer_null(JSON_Writer *writer);
+bool json_writer_bool(JSON_Writer *writer, bool value);
+bool json_writer_int64(JSON_Writer *writer, int64_t value);
+bool json_writer_double(JSON_Writer *writer, double value);
+bool json_writer_string(JSON_Writer *writer, const char *str, size_t len);
+bool json_writer_value(JSON_Writer *writer, const void *value);
+
+#define json_writer_key_cstr(writer, key) \
+	json_writer_key(writer, key, strlen(key))
+
+#define json_writer_string_cstr(writer, str) \
+	json_writer_string(writer, str, strlen(str))
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+#endif // JSON_WRITER_H_